@@ -14,9 +14,32 @@ cfg = msvc_env.BuildCfg(
 env = msvc_env.MsvcEnvironment(cfg)
 env.set_build_dir("src", "build")
 env.Append(CPPPATH=["."])
-objs = env.Object(source=["tatdylf.cpp", "tatdylf_ui.cpp"])
+srcs = [
+    "tatdylf.cpp",
+    "tatdylf_ui.cpp",
+    "tatdylf_stats.cpp",
+    "tatdylf_ini.cpp",
+    "tatdylf_repl.cpp",
+    "tatdylf_opt.cpp",
+    "tatdylf_policy.cpp",
+    "tatdylf_rio.cpp",
+    "tatdylf_query.cpp",
+    "tatdylf_plug.cpp",
+    "tatdylf_reload.cpp",
+    "tatdylf_pipe.cpp",
+    "tatdylf_sched.cpp",
+    "tatdylf_neigh.cpp",
+    "tatdylf_wild.cpp",
+    ]
+objs = env.Object(source=srcs)
 res = env.RES("tatdylf.rc")
-libs = ["kernel32.lib", "ws2_32.lib", "user32.lib", "shell32.lib"]
+libs = [
+    "kernel32.lib",
+    "ws2_32.lib",
+    "user32.lib",
+    "shell32.lib",
+    "iphlpapi.lib",
+    ]
 exe = env.Program("tatdylf.exe", objs + res, LIBS=libs)
 
 if env.sqaub_applicable():
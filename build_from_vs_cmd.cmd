@@ -1,6 +1,6 @@
 rc /fotatdylf.res src\tatdylf.rc
 @set copts=/O1 /Os /GL /GS- /Isrc
 @set lopts=/entry:entry_point /subsystem:console /fixed /merge:.rdata=.text
-@set libs=kernel32.lib ws2_32.lib user32.lib shell32.lib
-@set infiles=src\tatdylf.cpp src\tatdylf_ui.cpp tatdylf.res
+@set libs=kernel32.lib ws2_32.lib user32.lib shell32.lib iphlpapi.lib
+@set infiles=src\tatdylf.cpp src\tatdylf_ui.cpp src\tatdylf_stats.cpp src\tatdylf_ini.cpp src\tatdylf_repl.cpp src\tatdylf_opt.cpp src\tatdylf_policy.cpp src\tatdylf_rio.cpp src\tatdylf_query.cpp src\tatdylf_plug.cpp src\tatdylf_reload.cpp src\tatdylf_pipe.cpp src\tatdylf_sched.cpp src\tatdylf_neigh.cpp src\tatdylf_wild.cpp tatdylf.res
 cl %copts% %infiles% %libs% /link %lopts%
@@ -35,12 +35,19 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static const uint32_t MAX_INTERFACES = 4;
 static const char APPL[] = "tatdylf";
 
-static uint32_t get_config(Config cfg[MAX_INTERFACES]);
+static ConfigTable *volatile table = nullptr;  // replaced by a reload
+static Config **serving = nullptr; // interfaces that could be bound
+static Settings settings;
+static char ini_file[MAX_PATH + 1];
+static LPFN_WSARECVMSG wsa_recv_msg = nullptr;
+
+static uint32_t get_config();
+static uint32_t open_sockets(Config *cfg, uint32_t num, Config ***good);
 static bool receive_request(Request *req, Config *cfg);
 static bool send_reply(Request *req, Config *cfg);
+static Config* lock_current(Config *pool);
 
 static inline char* ip2string(uint32_t ip)
 {
@@ -51,65 +58,368 @@ static inline char* ip2string(uint32_t ip)
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static DWORD WINAPI run_dhcp(void* param)
+void print_config(const Config& cfg)
 {
-    Config& cfg = *static_cast<Config*>(param);
-    print_fmt("Host  : %s\n", ip2string(cfg.server_ip));
+    if (cfg.relay_ip)
+    {
+        print_fmt("Relay : %s\n", ip2string(cfg.relay_ip));
+    }
+    else
+    {
+        print_fmt("Host  : %s\n", ip2string(cfg.server_ip));
+    }
     print_fmt("Range : %s - ", ip2string(htonl(cfg.range_start)));
     print_fmt("%s\n", ip2string(htonl(cfg.range_end)));
-    print_fmt("Lease : %u\n\n", cfg.lease);
+    print_fmt("Lease : %u\n", cfg.lease);
+    if (cfg.policy)
+    {
+        print_fmt("Rules : %u\n", cfg.policy->num_rules);
+    }
+    print_fmt("\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void log_allotted(const Request *req)
+{
+    SYSTEMTIME st;
+    GetLocalTime(&st);
+    print_fmt("Allotted %s to ", ip2string(req->packet.yiaddr));
+    static const int MAC_SIZE = 6;
+    const uint8_t *m = reinterpret_cast<const uint8_t*>(req->packet.chaddr);
+    for (int i = 0; i < MAC_SIZE; i++)
+    {
+        print_fmt("%02X:", m[i]);
+    }
+    print_fmt(
+        "\b for %us at %2d:%02d:%02d\n",
+        req->pool->lease,
+        st.wHour,
+        st.wMinute,
+        st.wSecond
+        );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void serve_request(Config& cfg, Request *req)
+{
+    if (receive_request(req, &cfg))
+    {
+        if (send_reply(req, &cfg))
+        {
+            log_allotted(req);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns once the socket has been closed by hot-plug or a reload.
+
+DWORD WINAPI run_dhcp(void* param)
+{
+    Config *cfg = static_cast<Config*>(param);
+    print_config(*cfg);
+
+    if (settings.pipeline && run_pipeline(cfg))
+    {
+        return 0;
+    }
 
+    // The request is touched before the first datagram arrives.
+    Request req;
+    zero_init(req);
+    sched_lock(&req, sizeof(req));
+    const Config *applied = nullptr;
     for (;;)
     {
-        Request req;
-        if (receive_request(&req, &cfg))
+        cfg = current_config(cfg);
+        if (const_cast<volatile SOCKET&>(cfg->socket) == INVALID_SOCKET)
+        {
+            return 0;
+        }
+        if (cfg != applied)
+        {
+            sched_apply(cfg);
+            applied = cfg;
+        }
+        serve_request(*cfg, &req);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// In single loop mode one thread serves up to WSA_MAXIMUM_WAIT_EVENTS
+// interfaces. This is meant for hosts where every camera segment is a VLAN
+// that the NIC driver exposes as an interface of its own. Instead of one
+// blocking thread per VLAN, there is just one per group of 64 of them.
+
+struct LoopGroup
+{
+    Config   **cfg;
+    uint32_t count;
+};
+
+// Removes the interface at 'idx' after a reload has dropped it. The last
+// one takes its place.
+
+static void loop_remove(LoopGroup *grp, WSAEVENT *events, uint32_t idx)
+{
+    WSACloseEvent(events[idx]);
+    const uint32_t last = --grp->count;
+    events[idx] = events[last];
+    grp->cfg[idx] = grp->cfg[last];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static DWORD WINAPI run_dhcp_loop(void* param)
+{
+    LoopGroup *grp = static_cast<LoopGroup*>(param);
+    Request req;
+    zero_init(req);
+    sched_lock(&req, sizeof(req));
+    WSAEVENT events[WSA_MAXIMUM_WAIT_EVENTS];
+    for (uint32_t idx = 0; idx < grp->count; idx++)
+    {
+        print_config(*grp->cfg[idx]);
+        events[idx] = WSACreateEvent();
+        WSAEventSelect(grp->cfg[idx]->socket, events[idx], FD_READ);
+
+        // a reload signals the event once it has closed the socket
+        Config *cfg = lock_current(grp->cfg[idx]);
+        if (cfg != nullptr)
+        {
+            cfg->wake = events[idx];
+            ReleaseSRWLockExclusive(&cfg->lock);
+        }
+    }
+
+    while (grp->count > 0)
+    {
+        DWORD res = WSAWaitForMultipleEvents(
+            grp->count,
+            events,
+            FALSE,
+            WSA_INFINITE,
+            FALSE
+            );
+        if (res >= WSA_WAIT_EVENT_0 + grp->count)
+        {
+            // WSA_WAIT_FAILED, the events of this group are unusable
+            print_fmt("wait error %d\n", WSAGetLastError());
+            break;
+        }
+        uint32_t idx = res - WSA_WAIT_EVENT_0;
+
+        // WSAWaitForMultipleEvents reports the lowest signaled index only.
+        // To not starve the others, we serve one request from each signaled
+        // socket before waiting again. Winsock will signal the event anew
+        // if there is more data to be read.
+        while (idx < grp->count)
         {
-            if (send_reply(&req, &cfg))
+            Config& cfg = *current_config(grp->cfg[idx]);
+            if (const_cast<volatile SOCKET&>(cfg.socket) == INVALID_SOCKET)
+            {
+                // the last one moved here is looked at again
+                loop_remove(grp, events, idx);
+            }
+            else
             {
-                SYSTEMTIME st;
-                GetLocalTime(&st);
-                print_fmt("Allotted %s to ", ip2string(req.packet.yiaddr));
-                static const int MAC_SIZE = 6;
-                uint8_t *m = reinterpret_cast<uint8_t*>(&req.packet.chaddr[0]);
-                for (int i = 0; i < MAC_SIZE; i++)
+                WSANETWORKEVENTS net_events;
+                zero_init(net_events);
+                int rc = WSAEnumNetworkEvents(
+                    cfg.socket,
+                    events[idx],
+                    &net_events
+                    );
+                if (rc == 0 && (net_events.lNetworkEvents & FD_READ))
                 {
-                    print_fmt("%02X:", m[i]);
+                    serve_request(cfg, &req);
                 }
-                print_fmt(
-                    "\b for %us at %2d:%02d:%02d\n",
-                    cfg.lease,
-                    st.wHour,
-                    st.wMinute,
-                    st.wSecond
-                    );
+                idx++;
+            }
+
+            if (idx >= grp->count)
+            {
+                break;
+            }
+            res = WSAWaitForMultipleEvents(
+                grp->count - idx,
+                &events[idx],
+                FALSE,
+                0,
+                FALSE
+                );
+            if (res >= WSA_WAIT_EVENT_0 + grp->count - idx)
+            {
+                // nothing else signaled, or the outer wait reports the error
+                break;
             }
+            idx += res - WSA_WAIT_EVENT_0;
         }
     }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void start_thread(LPTHREAD_START_ROUTINE func, void* param)
+{
+    CloseHandle(CreateThread(nullptr, 0, func, param, 0, nullptr));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 void entry_point()
 {
-    Config cfg[MAX_INTERFACES];
-    uint32_t num_good = get_config(cfg);
+    stats_init();
+    uint32_t num_good = get_config();
+    uint32_t num_ifaces = 0;
+    Config *configs = num_good > 0 ? table->configs : nullptr;
     if (num_good > 0)
     {
         send_console_to_tray(APPL, LoadIcon(GetModuleHandle(nullptr), APPL));
-        for (uint32_t idx = 1; idx < num_good; idx++)
-        {
-            CloseHandle(
-                CreateThread(
-                    nullptr,
-                    0,
-                    run_dhcp,
-                    static_cast<void*>(&cfg[idx]),
-                    0,
-                    nullptr
-                    )
+        if (settings.query_pipe[0] && !query_start(settings.query_pipe))
+        {
+            print_fmt("no lease query service\n");
+        }
+        if (settings.neighbors && !neigh_start())
+        {
+            print_fmt("no neighbor entries\n");
+        }
+        if (settings.stats_interval && !stats_start(settings.stats_interval))
+        {
+            print_fmt("no periodic statistics\n");
+        }
+        if (settings.repl_role != REPL_NONE)
+        {
+            if (!repl_init(configs, table->num_pools, &settings))
+            {
+                num_good = 0;
+            }
+            else if (
+                settings.repl_role == REPL_STANDBY ||
+                repl_peer_active()
+                )
+            {
+                // returns once the active instance has gone
+                repl_run_standby();
+            }
+        }
+    }
+    if (num_good > 0)
+    {
+        if (settings.wildcard && !wild_open(wsa_recv_msg))
+        {
+            print_fmt("no wildcard socket\n");
+            settings.wildcard = false;
+        }
+        if (settings.rio && !settings.wildcard && !rio_init())
+        {
+            print_fmt("registered I/O not available\n");
+            settings.rio = false;
+        }
+        num_ifaces = num_good;
+        if (!settings.wildcard)
+        {
+            num_good = open_sockets(configs, num_ifaces, &serving);
+        }
+    }
+
+    // Interfaces follow their address through hot-plug with a thread each.
+    // In the modes that serve many interfaces from one thread, this only
+    // applies to those that could not be bound now. The wildcard socket
+    // finds interfaces that come up later by itself.
+    const bool loops = settings.rio || settings.single_loop;
+    bool hot_plug = false;
+    if (num_ifaces > 0 && !settings.wildcard)
+    {
+        Config **plugged = static_cast<Config**>(
+            mem_alloc(num_ifaces * sizeof(Config*))
+            );
+        uint32_t num_plugged = 0;
+        for (uint32_t idx = 0; plugged && idx < num_ifaces; idx++)
+        {
+            if (!loops || configs[idx].socket == INVALID_SOCKET)
+            {
+                plugged[num_plugged++] = &configs[idx];
+            }
+        }
+        if (num_plugged > 0)
+        {
+            hot_plug = plug_add(plugged, num_plugged);
+            if (!hot_plug)
+            {
+                print_fmt("no hot-plug\n");
+            }
+        }
+        mem_free(plugged);
+    }
+
+    if (num_good > 0 || hot_plug)
+    {
+        Config **cfg = serving;
+
+        // Both instances of a replication pair have to agree on the pools,
+        // so the ini file is only reloaded without replication.
+        if (settings.repl_role != REPL_NONE)
+        {
+            start_thread(repl_run_active, nullptr);
+        }
+        else if (!reload_start(ini_file))
+        {
+            print_fmt("no reload\n");
+        }
+        if (settings.wildcard)
+        {
+            wild_run();
+        }
+        if (settings.rio && num_good > 0)
+        {
+            // returns only if registered I/O could not be set up
+            rio_run(cfg, num_good);
+        }
+        if (settings.single_loop && num_good > 0)
+        {
+            const uint32_t num_groups = (
+                (num_good + WSA_MAXIMUM_WAIT_EVENTS - 1) /
+                WSA_MAXIMUM_WAIT_EVENTS
+                );
+            LoopGroup *groups = static_cast<LoopGroup*>(
+                mem_alloc(num_groups * sizeof(LoopGroup))
                 );
+            for (uint32_t idx = 0; idx < num_groups; idx++)
+            {
+                const uint32_t first = idx * WSA_MAXIMUM_WAIT_EVENTS;
+                groups[idx].cfg = &cfg[first];
+                groups[idx].count = num_good - first;
+                if (groups[idx].count > WSA_MAXIMUM_WAIT_EVENTS)
+                {
+                    groups[idx].count = WSA_MAXIMUM_WAIT_EVENTS;
+                }
+                if (idx > 0)
+                {
+                    start_thread(run_dhcp_loop, &groups[idx]);
+                }
+            }
+            run_dhcp_loop(&groups[0]);
+        }
+        else if (num_good > 0 && (loops || !hot_plug))
+        {
+            for (uint32_t idx = 1; idx < num_good; idx++)
+            {
+                start_thread(run_dhcp, cfg[idx]);
+            }
+            run_dhcp(cfg[0]);
+        }
+
+        // everything else is served by the threads of hot-plug
+        for (;;)
+        {
+            Sleep(INFINITE);
         }
-        run_dhcp(&cfg[0]);
     }
     else
     {
@@ -120,63 +430,161 @@ void entry_point()
 
 ////////////////////////////////////////////////////////////////////////////////
 
-bool receive_request(Request *req, Config *cfg)
+void dump_stats()
+{
+    // Interfaces without an address at the moment are left out.
+    const ConfigTable *tbl = table;
+    for (uint32_t idx = 0; tbl && idx < tbl->num_ifaces; idx++)
+    {
+        const Config &cfg = tbl->configs[idx];
+        if (cfg.socket != INVALID_SOCKET || wild_serving())
+        {
+            dump_latency(&cfg.stats, cfg.server_ip);
+            dump_drops(&cfg.drops);
+            dump_pipe(&cfg.pipe);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int receive_with_timestamp(Request *req, Config *cfg)
+{
+    WSABUF buf;
+    buf.buf = req->buffer;
+    buf.len = sizeof(Packet);
+
+    uint64_t control[8];
+    WSAMSG msg;
+    zero_init(msg);
+    msg.lpBuffers = &buf;
+    msg.dwBufferCount = 1;
+    msg.Control.buf = reinterpret_cast<char*>(control);
+    msg.Control.len = sizeof(control);
+
+    DWORD size;
+    if (wsa_recv_msg(cfg->socket, &msg, &size, nullptr, nullptr) != 0)
+    {
+        return SOCKET_ERROR;
+    }
+    req->tsc[MARK_RECEIVED] = __rdtsc();
+
+    WSACMSGHDR *cmsg = WSA_CMSG_FIRSTHDR(&msg);
+    for (; cmsg != nullptr; cmsg = WSA_CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMP)
+        {
+            mem_cpy(&req->rx_qpc, WSA_CMSG_DATA(cmsg), sizeof(req->rx_qpc));
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            req->user_qpc = static_cast<uint64_t>(now.QuadPart);
+        }
+    }
+    return static_cast<int>(size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns the size of the datagram or SOCKET_ERROR.
+
+int receive_datagram(Request *req, Config *cfg)
 {
     zero_init(*req);
 
-    sockaddr from;
-    int from_len = sizeof(from);
-    int size = recvfrom(
-        cfg->socket,
-        req->buffer,
-        sizeof(Packet),
-        0,
-        &from,
-        &from_len
-        );
+    int size;
+    if (cfg->rx_timestamps)
+    {
+        size = receive_with_timestamp(req, cfg);
+    }
+    else
+    {
+        sockaddr from;
+        int from_len = sizeof(from);
+        size = recvfrom(
+            cfg->socket,
+            req->buffer,
+            sizeof(Packet),
+            0,
+            &from,
+            &from_len
+            );
+        req->tsc[MARK_RECEIVED] = __rdtsc();
+    }
     if (size == SOCKET_ERROR)
     {
-        print_fmt("rr error: %d\n", WSAGetLastError());
-        return false;
+        const int err = WSAGetLastError();
+        if (err != WSAEWOULDBLOCK)
+        {
+            print_fmt("rr error: %d\n", err);
+        }
     }
+    return size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool receive_request(Request *req, Config *cfg)
+{
+    const int size = receive_datagram(req, cfg);
+    return size != SOCKET_ERROR && parse_request(req, size, cfg);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The fixed part of the message is checked first, so that foreign traffic is
+// dropped before the options are looked at. The drops are only counted, since
+// printing a line for every one of them would cost more than the rest.
 
-    const uint8_t req_op = req->packet.op;
-    const uint32_t cookie = req->packet.magic_cookie;
-    if (req_op != BOOTP_REQUEST || cookie != DHCP_COOKIE)
+static const uint32_t ETHERNET_MASK = 0x00ffffff; // op, htype and hlen
+static const uint32_t ETHERNET_LE   = 0x00060101; // 1, 1 and 6
+
+bool parse_request(Request *req, int size, Config *cfg)
+{
+    volatile uint32_t *drops = cfg->drops.counts;
+    if (size < static_cast<int>(FIELD_OFFSET(Packet, options)))
+    {
+        drops[DROP_SHORT]++;
+        return false;
+    }
+    uint32_t head;
+    mem_cpy(&head, req->buffer, sizeof(head));
+    if ((head & ETHERNET_MASK) != ETHERNET_LE)
+    {
+        drops[
+            req->packet.op != BOOTP_REQUEST ?
+            DROP_NOT_REQUEST :
+            DROP_NOT_ETHERNET
+            ]++;
+        return false;
+    }
+    if (req->packet.magic_cookie != DHCP_COOKIE)
     {
-        print_fmt("not DHCP: %u, %x\n", req_op, cookie);
+        drops[DROP_NO_COOKIE]++;
         return false;
     }
 
-    uint8_t *src = req->packet.options;
-    uint8_t tag = *src++;
-    while (tag != DOPT_END)
+    req->size = static_cast<uint32_t>(size);
+    if (!parse_options(req))
     {
-        if (tag != DOPT_PAD)
-        {
-            uint8_t size = *src++;
-            switch (tag)
-            {
-                case DOPT_MESSAGE_TYPE:
-                    req->request_msg = *src;
-                    break;
-                case DOPT_SERVER_IDENT:
-                    mem_cpy(&req->server_ip, src, sizeof(req->server_ip));
-                    break;
-                case DOPT_REQUESTED_IP_ADDR:
-                    mem_cpy(&req->requested_ip, src, sizeof(req->requested_ip));
-                    break;
-            }
-            src += size;
-        }
-        tag = *src++;
+        drops[DROP_MALFORMED]++;
+        return false;
+    }
+    if (
+        req->request_msg != DMSG_DISCOVER &&
+        req->request_msg != DMSG_REQUEST &&
+        req->request_msg != DMSG_RELEASE
+        )
+    {
+        drops[DROP_MSG_TYPE]++;
+        return false;
     }
+    req->tsc[MARK_PARSED] = __rdtsc();
     return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static uint32_t seconds_since_start()
+uint32_t seconds_since_start()
 {
     // There is NO overflow problem here! 'seconds_since_start' will deliver
     // continuing one second increments for approx. 136 years.
@@ -208,97 +616,326 @@ static inline bool equal_chaddr(const uint32_t *a, const uint32_t *b)
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static uint32_t assign_address(Request *req, Config *cfg)
+static inline bool is_empty(const Client& client)
 {
-    uint32_t empty[CHADDR_N32];
-    zero_init(empty);
+    return (client.chaddr[0] | client.chaddr[1]) == 0;
+}
 
-    uint32_t now = seconds_since_start();
+////////////////////////////////////////////////////////////////////////////////
 
-    const int num_addr = cfg->range_end - cfg->range_start + 1;
-    int expired = -1;
-    int i = 0;
+// With 'affinity' a client is placed at a slot derived from its MAC, so that
+// a camera gets the same address after a restart without any persisted
+// state. Collisions are resolved by linear probing within the range of the
+// policy. The probe ends at the entry of the client or at an empty slot,
+// since the client would have been placed there. Expired entries are kept
+// until they are reused, also by a full sync to the standby, so they do not
+// cut the probe sequence of the clients placed behind them. The first empty
+// or expired slot is taken if the client has none of the probed ones.
+// Returns -1 if all probed slots are held by other clients.
 
-    for (; i < num_addr; i++)
+static const uint32_t AFFINITY_PROBES = 8;
+
+static inline uint32_t hash_chaddr(const uint32_t *chaddr)
+{
+    // FNV-1a over the six bytes of the MAC. It must not be seeded, otherwise
+    // the slots would change with every start.
+    const uint8_t *mac = reinterpret_cast<const uint8_t*>(chaddr);
+    uint32_t hash = 2166136261U;
+    for (uint32_t idx = 0; idx < 6; idx++)
+    {
+        hash = (hash ^ mac[idx]) * 16777619U;
+    }
+    return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int affine_slot(
+    const Config *cfg,
+    const uint32_t *chaddr,
+    uint32_t first,
+    uint32_t last,
+    uint32_t now
+    )
+{
+    const uint32_t num = last - first + 1;
+    const uint32_t probes = num < AFFINITY_PROBES ? num : AFFINITY_PROBES;
+    uint32_t idx = hash_chaddr(chaddr) % num;
+    int reusable = -1;
+    for (uint32_t probe = 0; probe < probes; probe++)
     {
-        if (
-            equal_chaddr(req->packet.chaddr, cfg->clients[i].chaddr) ||
-            equal_chaddr(cfg->clients[i].chaddr, empty)
-            )
+        const Client &client = cfg->clients[first + idx];
+        if (equal_chaddr(chaddr, client.chaddr))
         {
-            // if this entry is unused or it is already reserved for the
-            // current client, we use it
-            break;
+            return static_cast<int>(first + idx);
         }
-
-        if (
-            !equal_chaddr(cfg->clients[i].chaddr, empty) &&
-            cfg->clients[i].expiry < now
-            )
+        const bool empty = is_empty(client);
+        if (reusable < 0 && (empty || client.expiry < now))
         {
-            // if this entry was once used, but its lease has run out,
-            // we memorize it to reuse it if necessary
-            expired = i;
+            reusable = static_cast<int>(first + idx);
         }
-    }
-
-    if (i >= num_addr)
-    {
-        // no unused or reserved entry found
-        if (expired >= 0)
+        if (empty)
         {
-            // but we can reuse an expired one
-            i = expired;
+            break;
         }
-        else
+        if (++idx == num)
         {
-            print_fmt("no available IP\n");
-            return 0;
+            idx = 0;
         }
     }
-
-    mem_cpy(cfg->clients[i].chaddr, req->packet.chaddr, sizeof(empty));
-    cfg->clients[i].expiry = now + 42;
-    return htonl(cfg->range_start + i);
+    return reusable;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static int client_index_from_ip(Config *cfg, uint32_t ip)
+// The lease table of a pool comes in one of two size classes. The search of
+// a free entry is compiled for each of them: the table is looked at in
+// blocks of 32 entries, and each block is compared completely, without any
+// branches, yielding a bitmap per kind of entry. A pool of NUM_CLIENTS is a
+// single block, while one of MAX_CLIENTS skips the blocks outside of the
+// range and stops at the first block that decides the search. Entries past
+// the end of the range are always empty and masked off along with those
+// before its start.
+
+static const uint32_t BLOCK_SIZE = 32;
+
+struct BlockMasks
 {
-    uint32_t ip_host_end = htonl(ip);
-    if (ip_host_end >= cfg->range_start && ip_host_end <= cfg->range_end)
+    uint32_t own;      // entry of the client
+    uint32_t unused;
+    uint32_t expired;  // includes unused ones
+};
+
+template <uint32_t IDX>
+struct BlockScan
+{
+    static FORCEINLINE void run(
+        const Client *block,
+        const uint32_t *chaddr,
+        uint32_t now,
+        BlockMasks *masks
+        )
     {
-        return (ip_host_end - cfg->range_start);
+        const Client &client = block[IDX];
+        masks->own |= static_cast<uint32_t>(
+            equal_chaddr(chaddr, client.chaddr)
+            ) << IDX;
+        masks->unused |= static_cast<uint32_t>(is_empty(client)) << IDX;
+        masks->expired |= static_cast<uint32_t>(client.expiry < now) << IDX;
+        BlockScan<IDX + 1>::run(block, chaddr, now, masks);
     }
-    else
+};
+
+template <>
+struct BlockScan<BLOCK_SIZE>
+{
+    static FORCEINLINE void run(
+        const Client*,
+        const uint32_t*,
+        uint32_t,
+        BlockMasks*
+        )
     {
-        return -1;
     }
-}
+};
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static inline int matching_client(uint32_t ip, uint32_t *chaddr, Config *cfg)
+// bits of [first, last] that fall into the block starting at 'base'
+
+static inline uint32_t range_mask(uint32_t first, uint32_t last, uint32_t base)
 {
-    int idx = client_index_from_ip(cfg, ip);
-    if (idx >= 0)
+    if (last < base || first >= base + BLOCK_SIZE)
     {
-        if (equal_chaddr(chaddr, cfg->clients[idx].chaddr))
-        {
-            return idx;
-        }
+        return 0;
     }
-    return -1;
+    const uint32_t lo = first > base ? first - base : 0;
+    const uint32_t hi = last - base < BLOCK_SIZE ? last - base : BLOCK_SIZE - 1;
+    return (0xffffffff >> (BLOCK_SIZE - 1 - hi)) & (0xffffffff << lo);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static inline uint8_t* write_unaligned_u32(uint8_t* ptr, uint32_t val)
-{
-    mem_cpy(ptr, &val, sizeof(val));
-    return ptr + sizeof(val);
-}
+// Searches [first, last] for the entry of the client, an unused one or
+// one whose lease has run out, in this order of preference. Returns -1 if
+// there is none.
+
+template <uint32_t CAPACITY>
+struct LeaseEngine
+{
+    static int scan(
+        const Config *cfg,
+        const uint32_t *chaddr,
+        uint32_t first,
+        uint32_t last,
+        uint32_t now
+        )
+    {
+        int unused = -1;
+        int expired = -1;
+        for (uint32_t base = 0; base < CAPACITY; base += BLOCK_SIZE)
+        {
+            const uint32_t in_range = range_mask(first, last, base);
+            if (in_range == 0)
+            {
+                continue;
+            }
+            BlockMasks masks;
+            zero_init(masks);
+            BlockScan<0>::run(&cfg->clients[base], chaddr, now, &masks);
+
+            const uint32_t own = masks.own & in_range;
+            const uint32_t free = masks.unused & in_range;
+            unsigned long bit;
+
+            // Without affinity entries are used from the start of the range,
+            // so there cannot be a reserved one after the first unused one.
+            // Whichever of the two comes first is taken.
+            if (!cfg->affinity && _BitScanForward(&bit, own | free))
+            {
+                return static_cast<int>(base + bit);
+            }
+            if (_BitScanForward(&bit, own))
+            {
+                // this entry is already reserved for the current client
+                return static_cast<int>(base + bit);
+            }
+            if (unused < 0 && _BitScanForward(&bit, free))
+            {
+                unused = static_cast<int>(base + bit);
+            }
+            // of the entries whose lease has run out, the last one is
+            // reused if necessary
+            const uint32_t stale = masks.expired & ~masks.unused & in_range;
+            if (_BitScanReverse(&bit, stale))
+            {
+                expired = static_cast<int>(base + bit);
+            }
+        }
+        return unused >= 0 ? unused : expired;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline int scan_slots(
+    const Config *cfg,
+    const uint32_t *chaddr,
+    uint32_t first,
+    uint32_t last,
+    uint32_t now
+    )
+{
+    if (cfg->capacity == NUM_CLIENTS)
+    {
+        return LeaseEngine<NUM_CLIENTS>::scan(cfg, chaddr, first, last, now);
+    }
+    return LeaseEngine<MAX_CLIENTS>::scan(cfg, chaddr, first, last, now);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t assign_address(Request *req, Config *cfg)
+{
+    uint32_t now = seconds_since_start();
+
+    // policies restrict the client to a part of the pool
+    uint32_t first;
+    uint32_t last;
+    policy_select(cfg, req, &first, &last);
+
+    int i = -1;
+    if (cfg->affinity)
+    {
+        i = affine_slot(cfg, req->packet.chaddr, first, last, now);
+    }
+    if (i < 0)
+    {
+        i = scan_slots(cfg, req->packet.chaddr, first, last, now);
+        if (i < 0)
+        {
+            print_fmt("no available IP\n");
+            return 0;
+        }
+    }
+
+    lease_write_begin(cfg);
+    mem_cpy(
+        cfg->clients[i].chaddr,
+        req->packet.chaddr,
+        sizeof(cfg->clients[i].chaddr)
+        );
+    cfg->clients[i].expiry = now + 42;
+    lease_write_end(cfg);
+    return htonl(cfg->range_start + i);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int client_index_from_ip(Config *cfg, uint32_t ip)
+{
+    uint32_t ip_host_end = htonl(ip);
+    if (ip_host_end >= cfg->range_start && ip_host_end <= cfg->range_end)
+    {
+        return (ip_host_end - cfg->range_start);
+    }
+    else
+    {
+        return -1;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline int matching_client(uint32_t ip, uint32_t *chaddr, Config *cfg)
+{
+    int idx = client_index_from_ip(cfg, ip);
+    if (idx >= 0)
+    {
+        if (equal_chaddr(chaddr, cfg->clients[idx].chaddr))
+        {
+            return idx;
+        }
+    }
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint8_t* write_unaligned_u32(uint8_t* ptr, uint32_t val)
+{
+    mem_cpy(ptr, &val, sizeof(val));
+    return ptr + sizeof(val);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static Config* find_relay_pool(uint32_t giaddr)
+{
+    const ConfigTable *tbl = table;
+    const RelayEntry *relays = tbl->relays;
+    const uint32_t num_relays = tbl->num_relays;
+    const uint32_t prefix = htonl(giaddr) & CC_SUB_MASK_LE;
+    uint32_t lo = 0;
+    uint32_t hi = num_relays;
+    while (lo < hi)
+    {
+        const uint32_t mid = (lo + hi) / 2;
+        if (relays[mid].prefix < prefix)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    if (lo < num_relays && relays[lo].prefix == prefix)
+    {
+        return relays[lo].pool;
+    }
+    return nullptr;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -321,24 +958,154 @@ static int finalize_reply(Request *req, Config *cfg)
 
     *dst++ = DOPT_ADDR_LEASE_TIME;
     *dst++ = sizeof(uint32_t);
-    dst = write_unaligned_u32(dst, htonl(cfg->lease));
+    dst = write_unaligned_u32(dst, htonl(req->pool->lease));
+
+    if (req->packet.giaddr)
+    {
+        // the relay agent is the client's way back to us
+        *dst++ = DOPT_ROUTER;
+        *dst++ = sizeof(uint32_t);
+        dst = write_unaligned_u32(dst, req->packet.giaddr);
+
+        // RFC 3046: the relay agent information has to be echoed verbatim
+        const uint8_t *end = req->packet.options + DHCP_OPT_SIZE;
+        const uint32_t len = req->relay_info_len;
+        if (len && dst + 2 + len + 1 <= end)
+        {
+            *dst++ = DOPT_RELAY_AGENT_INFO;
+            *dst++ = static_cast<uint8_t>(len);
+            mem_cpy(dst, req->relay_info, len);
+            dst += len;
+        }
+    }
 
     *dst++ = DOPT_END;
+    if (req->overload)
+    {
+        // these held options of the request, but the reply does not
+        // overload them
+        zero_init(req->packet.sname);
+        zero_init(req->packet.file);
+    }
     req->packet.op = BOOTP_REPLY;
     return static_cast<int>(dst - reinterpret_cast<uint8_t*>(req->buffer));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-bool send_reply(Request *req, Config *cfg)
+// Locks the Config that currently stands for 'pool'. A reload retires a
+// Config under its lock, so one that was not retired when we got the lock
+// stays current until we release it. Returns nullptr if it was removed.
+
+static Config* lock_current(Config *pool)
+{
+    for (;;)
+    {
+        AcquireSRWLockExclusive(&pool->lock);
+        if (!pool->retired)
+        {
+            return pool;
+        }
+        Config *next = pool->successor;
+        ReleaseSRWLockExclusive(&pool->lock);
+        if (next == nullptr)
+        {
+            return nullptr;
+        }
+        pool = next;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// RFC 2131 4.4.6: a client that gives up its address unicasts a DHCPRELEASE
+// to the server, so it arrives without giaddr even from behind a relay
+// agent, and the pool has to be found by the address. The entry keeps the
+// MAC, so the client gets the same address back if it asks again.
+
+static void release_lease(Request *req, Config *cfg)
 {
-    int client2update = -1;
+    const uint32_t ip = req->packet.ciaddr;
+    Config *pool = cfg;
+    if (client_index_from_ip(cfg, ip) < 0)
+    {
+        pool = find_relay_pool(ip);
+        if (pool == nullptr)
+        {
+            return;
+        }
+    }
+    pool = lock_current(pool);
+    if (pool == nullptr)
+    {
+        return;
+    }
+    const int idx = matching_client(ip, req->packet.chaddr, pool);
+    if (idx >= 0)
+    {
+        lease_write_begin(pool);
+        pool->clients[idx].expiry = 0;
+        lease_write_end(pool);
+    }
+    const bool local = pool->server_ip != 0;
+    ReleaseSRWLockExclusive(&pool->lock);
+    if (idx >= 0)
+    {
+        print_fmt("Released %s\n", ip2string(ip));
+        repl_publish(ip, req->packet.chaddr, 0);
+        if (local)
+        {
+            neigh_remove(ip);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Decides about the reply and encodes it. Returns its size or 0 if there is
+// nothing to send.
+
+int prepare_reply(Request *req, Config *cfg, sockaddr_in *to)
+{
+    if (req->request_msg == DMSG_RELEASE)
+    {
+        // never answered
+        release_lease(req, cfg);
+        return 0;
+    }
+
+    // 'cfg' is the interface the request arrived on, 'pool' the one whose
+    // addresses are handed out.
+    Config *pool = cfg;
+    if (req->packet.giaddr)
+    {
+        pool = find_relay_pool(req->packet.giaddr);
+        if (pool == nullptr)
+        {
+            print_fmt("unknown relay: %s\n", ip2string(req->packet.giaddr));
+            return 0;
+        }
+    }
+
+    req->lease_idx = -1;
     req->reply_msg = DMSG_NAK;
     req->packet.yiaddr = 0;
 
+    if (req->request_msg != DMSG_DISCOVER && req->request_msg != DMSG_REQUEST)
+    {
+        // no reply for unhandled messages
+        return 0;
+    }
+
+    pool = lock_current(pool);
+    if (pool == nullptr)
+    {
+        return 0;
+    }
+    req->pool = pool;
     if (req->request_msg == DMSG_DISCOVER)
     {
-        req->packet.yiaddr = assign_address(req, cfg);
+        req->packet.yiaddr = assign_address(req, pool);
         if (req->packet.yiaddr)
         {
             req->reply_msg = DMSG_OFFER;
@@ -353,8 +1120,8 @@ bool send_reply(Request *req, Config *cfg)
                 );
             if (ip)
             {
-                client2update = matching_client(ip, req->packet.chaddr, cfg);
-                if (client2update >= 0)
+                req->lease_idx = matching_client(ip, req->packet.chaddr, pool);
+                if (req->lease_idx >= 0)
                 {
                     req->reply_msg = DMSG_ACK;
                     req->packet.yiaddr = ip;
@@ -362,68 +1129,349 @@ bool send_reply(Request *req, Config *cfg)
             }
         }
     }
+    ReleaseSRWLockExclusive(&pool->lock);
+
+    req->tsc[MARK_ASSIGNED] = __rdtsc();
+
+    // RFC 2131 4.1: replies to relayed requests go to the relay agent's
+    // server port.
+    to->sin_family = AF_INET;
+    if (req->packet.giaddr)
+    {
+        to->sin_port = htons(SERVER_PORT);
+        to->sin_addr.s_addr = req->packet.giaddr;
+    }
     else
     {
-        // no reply for unhandled messages
+        to->sin_port = htons(CLIENT_PORT);
+        to->sin_addr.s_addr = INADDR_BROADCAST;
+    }
+
+    const int size = finalize_reply(req, cfg);
+    req->tsc[MARK_ENCODED] = __rdtsc();
+    return size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Extends the lease once an ACK has been sent. Returns true if it did so.
+
+bool commit_reply(Request *req)
+{
+    if (req->lease_idx < 0)
+    {
         return false;
     }
 
-    sockaddr_in to;
-    to.sin_family = AF_INET;
-    to.sin_port = htons(CLIENT_PORT);
-    to.sin_addr.s_addr = INADDR_BROADCAST;
+    // The lock was released while sending, so check that the entry still
+    // belongs to this client before extending the lease.
+    Config *pool = lock_current(req->pool);
+    if (pool == nullptr)
+    {
+        return false;
+    }
+    if (pool != req->pool)
+    {
+        // a reload has moved the lease
+        req->pool = pool;
+        req->lease_idx = matching_client(
+            req->packet.yiaddr,
+            req->packet.chaddr,
+            pool
+            );
+    }
+    bool committed = false;
+    uint32_t t = seconds_since_start();
+    uint32_t expiry = 0;
+    Client *client = (
+        req->lease_idx >= 0 ? &pool->clients[req->lease_idx] : nullptr
+        );
+    if (client != nullptr && equal_chaddr(client->chaddr, req->packet.chaddr))
+    {
+        lease_write_begin(pool);
+        expiry = client->expiry = (
+            (UINT32_MAX - t > pool->lease) ?
+            t + pool->lease :
+            UINT32_MAX
+            );
+        lease_write_end(pool);
+        committed = true;
+    }
+    const bool local = pool->server_ip != 0;
+    ReleaseSRWLockExclusive(&pool->lock);
+    if (committed)
+    {
+        repl_publish(req->packet.yiaddr, req->packet.chaddr, expiry);
 
-    int size = finalize_reply(req, cfg);
+        // cameras behind a relay agent are not our neighbors
+        if (local)
+        {
+            neigh_add(req->packet.yiaddr, req->packet.chaddr, expiry);
+        }
+    }
+    return committed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns true if a lease was committed.
+
+bool transmit_reply(
+    Request *req,
+    Config *cfg,
+    const sockaddr_in& to,
+    int size
+    )
+{
     size = sendto(
         cfg->socket,
         req->buffer,
         size,
         0,
-        reinterpret_cast<sockaddr*>(&to),
+        reinterpret_cast<const sockaddr*>(&to),
         sizeof(to)
         );
     if (size == SOCKET_ERROR)
     {
         print_fmt("sr error %d\n", WSAGetLastError());
+        return false;
     }
+    req->tsc[MARK_SENT] = __rdtsc();
+    record_latency(&cfg->stats, req);
+    return commit_reply(req);
+}
+
+////////////////////////////////////////////////////////////////////////////////
 
-    if (size > 0 && client2update >= 0)
+bool send_reply(Request *req, Config *cfg)
+{
+    sockaddr_in to;
+    const int size = prepare_reply(req, cfg, &to);
+    return size != 0 && transmit_reply(req, cfg, to, size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool parse_global(
+    const Ini *ini,
+    const IniSection *sec,
+    Settings *settings
+    )
+{
+    for (uint32_t idx = 0; idx < sec->count; idx++)
     {
-        uint32_t t = seconds_since_start();
-        cfg->clients[client2update].expiry = (
-            (UINT32_MAX - t > cfg->lease) ?
-            t + cfg->lease :
-            UINT32_MAX
-            );
-        return true;
+        const IniEntry &entry = ini->entries[sec->first + idx];
+        if (ini_equal(entry.key, "single_loop"))
+        {
+            if (!ini_parse_bool(entry.value, &settings->single_loop))
+            {
+                return ini_error(entry.line, "invalid single_loop");
+            }
+        }
+        else if (ini_equal(entry.key, "rio"))
+        {
+            if (!ini_parse_bool(entry.value, &settings->rio))
+            {
+                return ini_error(entry.line, "invalid rio");
+            }
+        }
+        else if (ini_equal(entry.key, "pipeline"))
+        {
+            if (!ini_parse_bool(entry.value, &settings->pipeline))
+            {
+                return ini_error(entry.line, "invalid pipeline");
+            }
+        }
+        else if (ini_equal(entry.key, "lock_memory"))
+        {
+            if (!ini_parse_bool(entry.value, &settings->lock_memory))
+            {
+                return ini_error(entry.line, "invalid lock_memory");
+            }
+        }
+        else if (ini_equal(entry.key, "wildcard"))
+        {
+            if (!ini_parse_bool(entry.value, &settings->wildcard))
+            {
+                return ini_error(entry.line, "invalid wildcard");
+            }
+        }
+        else if (ini_equal(entry.key, "neighbors"))
+        {
+            if (!ini_parse_bool(entry.value, &settings->neighbors))
+            {
+                return ini_error(entry.line, "invalid neighbors");
+            }
+        }
+        else if (ini_equal(entry.key, "query"))
+        {
+            // pipe name without the \\.\pipe\ prefix
+            const IniStr &name = entry.value;
+            bool valid = name.len > 0 && name.len < MAX_PATH - 16;
+            for (uint32_t pos = 0; valid && pos < name.len; pos++)
+            {
+                valid = name.ptr[pos] != '\\';
+            }
+            if (!valid)
+            {
+                return ini_error(entry.line, "invalid query");
+            }
+            // the value is not terminated inside the mapped ini file
+            mem_cpy(settings->query_pipe, name.ptr, name.len);
+            settings->query_pipe[name.len] = 0;
+        }
+        else if (ini_equal(entry.key, "stats"))
+        {
+            // one day at most, so that the milliseconds fit into a DWORD
+            if (
+                !ini_parse_u32(entry.value, &settings->stats_interval) ||
+                settings->stats_interval > 86400
+                )
+            {
+                return ini_error(entry.line, "invalid stats");
+            }
+        }
+        else
+        {
+            return ini_error(entry.line, "unknown key");
+        }
     }
-    return false;
+    return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static bool get_single_config(Config *cfg, const char *section, const char* ini)
+static bool parse_section(const Ini *ini, const IniSection *sec, Config *cfg)
 {
-
     zero_init(*cfg);
+    cfg->socket = INVALID_SOCKET;
+    cfg->cpu = CPU_ANY;
 
-    ///////////////////////////// server ip ////////////////////////////////////
+    // [ifaceN] describes a local interface, [relayN] a subnet behind a
+    // relay agent whose address is given by 'ip'
+    const bool relay = ini_starts_with(sec->name, "relay");
+    if (!relay && !ini_starts_with(sec->name, "iface"))
+    {
+        return ini_error(sec->line, "unknown section");
+    }
+    IniStr suffix;
+    suffix.ptr = sec->name.ptr + 5;
+    suffix.len = sec->name.len - 5;
+    uint32_t num;
+    if (!ini_parse_u32(suffix, &num))
+    {
+        return ini_error(sec->line, "invalid section name");
+    }
+    uint32_t max_size = NUM_CLIENTS;
+
+    // these keys have defaults, so a repeated one cannot be told by its value
+    bool has_affinity = false;
+    bool has_size = false;
+    bool has_cpu = false;
+    bool has_priority = false;
 
-    uint32_t server_ip_host_end;
-    char str[256];
-    if (GetPrivateProfileString(section, "ip", "", str, sizeof(str), ini))
+    for (uint32_t idx = 0; idx < sec->count; idx++)
     {
-        cfg->server_ip = inet_addr(str);
-        server_ip_host_end = htonl(cfg->server_ip);
-        if ((server_ip_host_end & CC_NET_MASK_LE) != CC_PREFIX_LE)
+        const IniEntry &entry = ini->entries[sec->first + idx];
+        if (ini_equal(entry.key, "ip"))
         {
-            print_fmt("not class C private: %s\n", str);
-            return false;
+            if (cfg->server_ip != 0)
+            {
+                return ini_error(entry.line, "duplicate ip");
+            }
+            if (!ini_parse_ip(entry.value, &cfg->server_ip))
+            {
+                return ini_error(entry.line, "invalid ip");
+            }
+        }
+        else if (ini_equal(entry.key, "lease"))
+        {
+            if (cfg->lease != 0)
+            {
+                return ini_error(entry.line, "duplicate lease");
+            }
+            if (!ini_parse_u32(entry.value, &cfg->lease) || cfg->lease == 0)
+            {
+                return ini_error(entry.line, "invalid lease");
+            }
+        }
+        else if (ini_equal(entry.key, "affinity"))
+        {
+            if (has_affinity)
+            {
+                return ini_error(entry.line, "duplicate affinity");
+            }
+            has_affinity = true;
+            if (!ini_parse_bool(entry.value, &cfg->affinity))
+            {
+                return ini_error(entry.line, "invalid affinity");
+            }
+        }
+        else if (ini_equal(entry.key, "size"))
+        {
+            if (has_size)
+            {
+                return ini_error(entry.line, "duplicate size");
+            }
+            has_size = true;
+            if (
+                !ini_parse_u32(entry.value, &max_size) ||
+                max_size == 0 ||
+                max_size > MAX_CLIENTS
+                )
+            {
+                return ini_error(entry.line, "invalid size");
+            }
+        }
+        else if (!relay && ini_equal(entry.key, "cpu"))
+        {
+            if (has_cpu)
+            {
+                return ini_error(entry.line, "duplicate cpu");
+            }
+            has_cpu = true;
+            const uint32_t max_cpu = sizeof(DWORD_PTR) * 8 - 1;
+            if (
+                !ini_parse_u32(entry.value, &cfg->cpu) ||
+                cfg->cpu > max_cpu
+                )
+            {
+                return ini_error(entry.line, "invalid cpu");
+            }
+        }
+        else if (!relay && ini_equal(entry.key, "priority"))
+        {
+            if (has_priority)
+            {
+                return ini_error(entry.line, "duplicate priority");
+            }
+            has_priority = true;
+            if (
+                !ini_parse_u32(entry.value, &cfg->priority) ||
+                cfg->priority < PRIORITY_MIN ||
+                cfg->priority > PRIORITY_MAX
+                )
+            {
+                return ini_error(entry.line, "invalid priority");
+            }
+        }
+        else if (!ini_equal(entry.key, "policy"))
+        {
+            // policies are compiled once the range is known
+            return ini_error(entry.line, "unknown key");
         }
     }
-    else
+
+    ///////////////////////////// server ip ////////////////////////////////////
+
+    if (cfg->server_ip == 0)
     {
-        return false;
+        return ini_error(sec->line, "missing ip");
+    }
+    const uint32_t server_ip_host_end = htonl(cfg->server_ip);
+    if ((server_ip_host_end & CC_NET_MASK_LE) != CC_PREFIX_LE)
+    {
+        return ini_error(sec->line, "not class C private");
     }
 
     ////////////////////////////// ip range ////////////////////////////////////
@@ -438,39 +1486,63 @@ static bool get_single_config(Config *cfg, const char *section, const char* ini)
         cfg->range_start = server_ip_host_end + 1;
         cfg->range_end = (server_ip_host_end & CC_SUB_MASK_LE) | 254;
     }
-    if ((cfg->range_end - cfg->range_start + 1) > NUM_CLIENTS)
+    if ((cfg->range_end - cfg->range_start + 1) > max_size)
     {
-        cfg->range_end = cfg->range_start + NUM_CLIENTS - 1;
+        cfg->range_end = cfg->range_start + max_size - 1;
+    }
+
+    // Pools that fit into the default size keep its small table.
+    const uint32_t num_addr = cfg->range_end - cfg->range_start + 1;
+    cfg->capacity = num_addr <= NUM_CLIENTS ? NUM_CLIENTS : MAX_CLIENTS;
+    cfg->clients = static_cast<Client*>(
+        mem_alloc(cfg->capacity * sizeof(Client))
+        );
+    if (cfg->clients == nullptr)
+    {
+        return ini_error(sec->line, "out of memory");
+    }
+    if (relay)
+    {
+        cfg->relay_ip = cfg->server_ip;
+        cfg->server_ip = 0;
     }
 
     ///////////////////////////// lease time ///////////////////////////////////
 
 #define TATDYLF_DEFAULT_LEASE_TIME 600
 
-#ifndef TATDYLF_DO_NOT_READ_LEASE_TIME
-    if (GetPrivateProfileString(section, "lease", "", str, sizeof(str), ini))
-    {
-        char *p = str;
-        while (*p == ' ') p++;
-        uint32_t accu = 0;
-        char c;
-        while ((c = *p++) != 0)
-        {
-            accu = accu * 10 + (c - '0');
-        }
-        cfg->lease = accu;
-    }
+#ifdef TATDYLF_DO_NOT_READ_LEASE_TIME
+    cfg->lease = 0;
+#endif
     if (!cfg->lease)
     {
         cfg->lease = TATDYLF_DEFAULT_LEASE_TIME;
     }
-#else
-    cfg->lease = TATDYLF_DEFAULT_LEASE_TIME;
-#endif
 
+    ////////////////////////////// policies ////////////////////////////////////
+
+    return policy_compile(ini, sec, cfg);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool open_socket(Config *cfg)
+{
     /////////////////////////////// socket /////////////////////////////////////
 
-    cfg->socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    DWORD flags = WSA_FLAG_OVERLAPPED;
+    if (settings.rio)
+    {
+        flags |= WSA_FLAG_REGISTERED_IO;
+    }
+    cfg->socket = WSASocket(
+        AF_INET,
+        SOCK_DGRAM,
+        IPPROTO_UDP,
+        nullptr,
+        0,
+        flags
+        );
     if (cfg->socket == INVALID_SOCKET)
     {
         print_fmt("failed to create socket\n");
@@ -503,44 +1575,292 @@ static bool get_single_config(Config *cfg, const char *section, const char* ini)
         err = WSAGetLastError();
         print_fmt("error %d\n", err);
         closesocket(cfg->socket);
+        cfg->socket = INVALID_SOCKET;
         return false;
     }
 
+    ///////////////////////////// timestamps ///////////////////////////////////
+
+    // Failing to enable receive timestamps is not an error. It merely means
+    // that we cannot tell how long a request had been waiting in the kernel.
+    if (wsa_recv_msg != nullptr)
+    {
+        TIMESTAMPING_CONFIG ts_cfg;
+        zero_init(ts_cfg);
+        ts_cfg.Flags = TIMESTAMPING_FLAG_RX;
+        DWORD returned;
+        cfg->rx_timestamps = WSAIoctl(
+            cfg->socket,
+            SIO_TIMESTAMPING,
+            &ts_cfg,
+            sizeof(ts_cfg),
+            nullptr,
+            0,
+            &returned,
+            nullptr,
+            nullptr
+            ) == 0;
+    }
+
     return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-uint32_t get_config(Config cfg[MAX_INTERFACES])
+static LPFN_WSARECVMSG get_wsa_recv_msg()
+{
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == INVALID_SOCKET)
+    {
+        return nullptr;
+    }
+    GUID guid = WSAID_WSARECVMSG;
+    LPFN_WSARECVMSG func = nullptr;
+    DWORD returned;
+    int err = WSAIoctl(
+        sock,
+        SIO_GET_EXTENSION_FUNCTION_POINTER,
+        &guid,
+        sizeof(guid),
+        &func,
+        sizeof(func),
+        &returned,
+        nullptr,
+        nullptr
+        );
+    closesocket(sock);
+    return err == 0 ? func : nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns false if an interface or relay pool other than 'cfg' uses the
+// same ip. The pools are still spread over both ends of the table here.
+
+static bool unique_ip(
+    const Config *ifaces,
+    uint32_t num_ifaces,
+    const Config *relays,
+    uint32_t num_relay_pools,
+    const Config *cfg
+    )
+{
+    const uint32_t ip = cfg->server_ip | cfg->relay_ip;
+    for (uint32_t idx = 0; idx < num_ifaces + num_relay_pools; idx++)
+    {
+        const Config *other = idx < num_ifaces ?
+            &ifaces[idx] : &relays[idx - num_ifaces];
+        if (other != cfg && (other->server_ip | other->relay_ip) == ip)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t get_config()
 {
-    uint32_t num_good = 0;
     WSADATA wsa_data;
     if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
     {
         print_fmt("no winsock\n");
-        return num_good;
+        return 0;
     }
+    wsa_recv_msg = get_wsa_recv_msg();
 
-    char ini_file[MAX_PATH + 1];
     GetModuleFileName(nullptr, ini_file, MAX_PATH);
     int len = sz_len(ini_file);
     while (len && ini_file[len] != '.') --len;
     sz_cpy(&ini_file[len + 1], "ini");
 
-    for (uint32_t idx = 0; idx < MAX_INTERFACES; idx++)
+    ConfigTable *tbl = load_config(&settings);
+    if (tbl == nullptr)
+    {
+        return 0;
+    }
+    table = tbl;
+    sched_init(settings.lock_memory);
+    sched_lock_table(tbl);
+    return tbl->num_ifaces;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void free_pools(Config *cfg, uint32_t num)
+{
+    for (uint32_t idx = 0; idx < num; idx++)
+    {
+        mem_free(cfg[idx].policy);
+        mem_free(cfg[idx].clients);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Reads the ini file into a new table. [global] and [replication] go to
+// 'sets'. Returns nullptr if the file is invalid.
+
+ConfigTable* load_config(Settings *sets)
+{
+    Ini ini;
+    if (!ini_load(&ini, ini_file))
+    {
+        return nullptr;
+    }
+
+    // All sections are validated before any socket is opened. Thus a typo
+    // in the last section cannot go unnoticed because an earlier one failed
+    // to bind.
+    // Interfaces are stored from the front of the table, relay pools from
+    // the back.
+    const uint32_t num_sections = ini.num_sections;
+    Config *configs = static_cast<Config*>(
+        mem_alloc(num_sections * sizeof(Config))
+        );
+    uint32_t num_ifaces = 0;
+    uint32_t num_relay_pools = 0;
+    bool valid = configs != nullptr;
+    for (uint32_t idx = 0; valid && idx < num_sections; idx++)
     {
-        char section[32];
-        wsprintf(section, "iface%u", idx);
-        if (get_single_config(&cfg[idx], section, ini_file))
+        const IniSection *sec = &ini.sections[idx];
+        if (ini_equal(sec->name, "global"))
         {
-            num_good++;
+            valid = parse_global(&ini, sec, sets);
+        }
+        else if (ini_equal(sec->name, "replication"))
+        {
+            valid = repl_parse(&ini, sec, sets);
         }
         else
         {
-            break;
+            Config *pool = ini_starts_with(sec->name, "relay") ?
+                &configs[num_sections - ++num_relay_pools] :
+                &configs[num_ifaces++];
+            valid = parse_section(&ini, sec, pool);
+            if (valid && !unique_ip(
+                configs,
+                num_ifaces,
+                &configs[num_sections - num_relay_pools],
+                num_relay_pools,
+                pool
+                ))
+            {
+                valid = ini_error(sec->line, "ip used by another section");
+            }
+        }
+    }
+    ini_free(&ini);
+
+    ConfigTable *tbl = static_cast<ConfigTable*>(
+        mem_alloc(sizeof(ConfigTable))
+        );
+    RelayEntry *relays = static_cast<RelayEntry*>(
+        mem_alloc((num_relay_pools + 1) * sizeof(RelayEntry))
+        );
+    if (!valid || tbl == nullptr || relays == nullptr)
+    {
+        if (configs != nullptr)
+        {
+            free_pools(configs, num_ifaces);
+            free_pools(
+                &configs[num_sections - num_relay_pools],
+                num_relay_pools
+                );
         }
+        mem_free(relays);
+        mem_free(tbl);
+        mem_free(configs);
+        return nullptr;
     }
 
+    // Move the relay pools right behind the interfaces and sort them by
+    // subnet.
+    for (uint32_t idx = 0; idx < num_relay_pools; idx++)
+    {
+        Config *pool = &configs[num_ifaces + idx];
+        mem_cpy(
+            pool,
+            &configs[num_sections - num_relay_pools + idx],
+            sizeof(Config)
+            );
+        print_config(*pool);
+
+        RelayEntry entry;
+        entry.prefix = htonl(pool->relay_ip) & CC_SUB_MASK_LE;
+        entry.pool = pool;
+        uint32_t pos = idx;
+        while (pos > 0 && relays[pos - 1].prefix > entry.prefix)
+        {
+            relays[pos] = relays[pos - 1];
+            pos--;
+        }
+        if (pos > 0 && relays[pos - 1].prefix == entry.prefix)
+        {
+            valid = false;
+        }
+        relays[pos] = entry;
+    }
+    if (!valid)
+    {
+        print_fmt("duplicate relay subnet\n");
+        free_pools(configs, num_ifaces + num_relay_pools);
+        mem_free(relays);
+        mem_free(tbl);
+        mem_free(configs);
+        return nullptr;
+    }
+
+    tbl->configs = configs;
+    tbl->num_ifaces = num_ifaces;
+    tbl->num_pools = num_ifaces + num_relay_pools;
+    tbl->relays = relays;
+    tbl->num_relays = num_relay_pools;
+    return tbl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ConfigTable* config_table()
+{
+    return table;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The new table has to be complete, since readers may pick it up right away.
+
+void publish_config(ConfigTable *tbl)
+{
+    InterlockedExchangePointer(
+        reinterpret_cast<void *volatile *>(&table),
+        tbl
+        );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t open_sockets(Config *cfg, uint32_t num, Config ***good)
+{
+    // Interfaces whose socket cannot be opened are skipped.
+    *good = static_cast<Config**>(mem_alloc(num * sizeof(Config*)));
+    if (*good == nullptr)
+    {
+        return 0;
+    }
+    uint32_t num_good = 0;
+    for (uint32_t idx = 0; idx < num; idx++)
+    {
+        if (open_socket(&cfg[idx]))
+        {
+            (*good)[num_good++] = &cfg[idx];
+        }
+        else
+        {
+            print_fmt("skipping %s\n", ip2string(cfg[idx].server_ip));
+        }
+    }
     return num_good;
 }
 
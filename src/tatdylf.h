@@ -42,10 +42,11 @@
 static const uint8_t  BOOTP_REQUEST  =   1;
 static const uint8_t  BOOTP_REPLY    =   2;
 static const uint32_t CHADDR_N32     =   4;
-static const uint32_t NUM_CLIENTS    =  32;
+static const uint32_t NUM_CLIENTS    =  32; // default size of a pool
+static const uint32_t MAX_CLIENTS    = 256; // size class of larger pools
 static const uint32_t SERVER_PORT    =  67;
 static const uint32_t CLIENT_PORT    =  68;
-static const uint32_t DHCP_OPT_SIZE  = 128;  // min required for Basler cameras
+static const uint32_t DHCP_OPT_SIZE  = 1232; // fills a 1500 byte ethernet frame
 static const uint32_t DHCP_COOKIE    = 0x63538263;
 static const uint32_t CC_NET_MASK_LE = 0xffff0000; // 255.255.0.0
 static const uint32_t CC_PREFIX_LE   = 0xc0a80000; // 192.168.0.0
@@ -78,6 +79,115 @@ struct Packet
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Points in time (TSC) at which a request passes from one stage of
+// processing to the next.
+
+enum TSC_MARKS
+{
+    MARK_RECEIVED,
+    MARK_PARSED,
+    MARK_ASSIGNED,
+    MARK_ENCODED,
+    MARK_SENT,
+    NUM_MARKS
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// STAGE_RECEIVE is the time from the kernel timestamping the datagram until
+// recvfrom returned and is measured in QPC ticks. All others are measured in
+// TSC cycles.
+
+enum STAGES
+{
+    STAGE_RECEIVE,
+    STAGE_PARSE,
+    STAGE_ASSIGN,
+    STAGE_ENCODE,
+    STAGE_SEND,
+    STAGE_TOTAL,
+    NUM_STAGES
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// HDR style histogram: values below HIST_SUB_COUNT are counted exactly, above
+// that every power of two is split into HIST_SUB_COUNT linear sub-buckets,
+// which yields a relative error of less than 1 / HIST_SUB_COUNT.
+
+static const uint32_t HIST_SUB_BITS  = 4;
+static const uint32_t HIST_SUB_COUNT = 1 << HIST_SUB_BITS;
+static const uint32_t HIST_MAX_BITS  = 40;
+static const uint32_t HIST_BUCKETS   = (
+    (HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT
+    );
+
+struct Histogram
+{
+    // There is exactly one writer (the serving thread of the interface), so
+    // plain increments suffice. Readers may see a count that is off by one,
+    // but never a torn value.
+    volatile uint32_t counts[HIST_BUCKETS];
+};
+
+struct LatencyStats
+{
+    Histogram stages[NUM_STAGES];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// reasons for dropping a datagram without a reply
+
+enum DROPS
+{
+    DROP_SHORT,         // shorter than the fixed part of a DHCP message
+    DROP_NOT_REQUEST,   // not a BOOTREQUEST
+    DROP_NOT_ETHERNET,  // hardware type or address length is not ethernet
+    DROP_NO_COOKIE,     // BOOTP, but not DHCP
+    DROP_MALFORMED,     // options run past the end or have invalid values
+    DROP_MSG_TYPE,      // neither DISCOVER nor REQUEST
+    NUM_DROPS
+};
+
+struct DropStats
+{
+    volatile uint32_t counts[NUM_DROPS];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Occupancy of the rings of the pipelined mode. Whenever an item is taken
+// out of a ring, the bucket of the number of items that were waiting in it
+// is incremented. Every ring has a single consumer, hence a single writer.
+
+static const uint32_t PIPE_SLOTS = 64;  // Requests per pipeline, power of 2
+
+enum PIPE_RINGS
+{
+    RING_FREE,  // free slots, taken by the receive thread
+    RING_RX,    // received, taken by the processing thread
+    RING_TX,    // processed, taken by the send thread
+    NUM_RINGS
+};
+
+struct PipeStats
+{
+    volatile uint32_t counts[NUM_RINGS][PIPE_SLOTS + 1];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// refers to the value of an option that is not copied out of the packet
+
+struct OptionRef
+{
+    uint16_t offset;  // into Request::buffer, 0 if the option is missing
+    uint8_t  len;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 struct Request
 {
     union
@@ -89,6 +199,17 @@ struct Request
     uint32_t requested_ip;
     uint8_t  request_msg;
     uint8_t  reply_msg;
+    uint8_t  overload;  // option 52: 1 -> 'file', 2 -> 'sname', 3 -> both
+    uint32_t size;      // number of bytes received
+    OptionRef vendor_class;
+    OptionRef client_id;
+    uint64_t rx_qpc;    // kernel receive timestamp, 0 if not available
+    uint64_t user_qpc;  // QPC when the datagram was handed to us
+    uint64_t tsc[NUM_MARKS];
+    struct Config *pool;
+    int32_t  lease_idx; // entry to extend once the ACK is sent, -1 if none
+    uint8_t  relay_info_len;
+    uint8_t  relay_info[255];  // option 82, echoed back to the relay agent
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -101,14 +222,198 @@ struct Client
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Policy rules steer clients into a sub-range of a pool. They are compiled
+// into a byte trie per option (a node refers to its first child and its next
+// sibling) and a sorted array of OUIs. Every node or OUI carries the index
+// of the first rule that matches it, so the lowest index found wins.
+
+static const uint8_t NO_RULE = 0xff;
+
+struct PolicyRule
+{
+    uint8_t first;  // index into Config::clients
+    uint8_t last;
+};
+
+struct TrieNode
+{
+    uint16_t child;    // 0: none (the root is never a child)
+    uint16_t sibling;  // 0: none
+    uint8_t  byte;
+    uint8_t  rule;
+};
+
+struct OuiEntry
+{
+    uint32_t oui;  // first three bytes of the MAC, big endian
+    uint8_t  rule;
+};
+
+struct Policy
+{
+    PolicyRule *rules;
+    uint32_t    num_rules;
+    TrieNode   *vendor;  // option 60, node 0 is the root
+    TrieNode   *client;  // option 61, node 0 is the root
+    OuiEntry   *ouis;
+    uint32_t    num_ouis;
+    uint8_t     any;     // rule matching every client or NO_RULE
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// A Config either describes a local interface (server_ip != 0) that has a
+// socket of its own, or a remote subnet behind a DHCP relay agent
+// (relay_ip != 0). Requests for the latter may arrive on any interface, so
+// the lease table is guarded by 'lock'.
+//
+// A reload of the ini file replaces a Config by a new one, that takes over
+// its socket and leases, and retires the old one under its lock. Threads
+// that still refer to the old one find the current one through 'successor'.
+
+static const uint32_t CPU_ANY      = 0xffffffff;
+static const uint32_t PRIORITY_MIN = 25;  // base priorities of the
+static const uint32_t PRIORITY_MAX = 31;  // real-time class above normal
+
 struct Config
 {
-    SOCKET   socket;
-    uint32_t server_ip;
-    uint32_t lease;
-    uint32_t range_start;
-    uint32_t range_end;
-    Client   clients[NUM_CLIENTS];
+    SOCKET       socket;
+    bool         rx_timestamps;
+    HANDLE       wake;     // event of the single loop serving 'socket'
+    SRWLOCK      lock;
+    volatile uint32_t seq;  // odd while 'clients' is being changed
+    uint32_t     server_ip;
+    uint32_t     relay_ip;
+    uint32_t     lease;
+    uint32_t     range_start;
+    uint32_t     range_end;
+    Policy       *policy;  // nullptr if there are no rules
+    bool         affinity; // derive the preferred slot from the MAC
+    uint32_t     cpu;      // of the serving thread, CPU_ANY: not pinned
+    uint32_t     priority; // of the serving thread, 0: normal
+    volatile bool retired; // replaced or removed by a reload
+    struct Config *volatile successor;  // nullptr if removed or current
+    uint32_t     capacity; // of 'clients': NUM_CLIENTS or MAX_CLIENTS
+    Client       *clients;
+    LatencyStats stats;
+    DropStats    drops;
+    PipeStats    pipe;
+};
+
+inline Config* current_config(Config *cfg)
+{
+    while (cfg->successor != nullptr)
+    {
+        cfg = cfg->successor;
+    }
+    return cfg;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// relay pools sorted by subnet for binary search
+
+struct RelayEntry
+{
+    uint32_t prefix;  // host byte order
+    Config   *pool;
+};
+
+// All Configs read from one version of the ini file. It is published as a
+// whole, so readers always see counts that match the arrays.
+
+struct ConfigTable
+{
+    Config     *configs;  // interfaces first, then relay pools
+    uint32_t   num_ifaces;
+    uint32_t   num_pools;
+    RelayEntry *relays;
+    uint32_t   num_relays;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Writers hold 'lock' exclusively and bracket every change of 'clients' with
+// these, so that readers which must not block the server can take a
+// consistent copy without the lock (see lease_snapshot). On x86 stores are
+// not reordered with other stores, so a compiler barrier is all we need.
+
+inline void lease_write_begin(Config *cfg)
+{
+    cfg->seq++;
+    _ReadWriteBarrier();
+}
+
+inline void lease_write_end(Config *cfg)
+{
+    _ReadWriteBarrier();
+    cfg->seq++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+enum REPL_ROLES
+{
+    REPL_NONE,
+    REPL_ACTIVE,
+    REPL_STANDBY
+};
+
+// settings from the [global] and [replication] sections of the ini file
+
+struct Settings
+{
+    bool        single_loop;    // serve up to 64 interfaces from one thread
+    bool        rio;            // use registered I/O if available
+    bool        pipeline;       // receive, process and send in own threads
+    bool        lock_memory;    // lock the pages used for serving
+    bool        neighbors;      // add neighbor entries for leases
+    bool        wildcard;       // serve all interfaces through one socket
+    uint32_t    stats_interval; // seconds between statistics dumps, 0: none
+    uint8_t     repl_role;
+    uint32_t    repl_takeover;  // ms without news from the active instance
+    uint32_t    repl_loss;      // percentage of datagrams dropped on purpose
+    sockaddr_in repl_local;
+    sockaddr_in repl_peer;
+    char        query_pipe[MAX_PATH];  // empty: no lease query service
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The ini file is mapped into memory and tokenized in a single pass. Names
+// and values are not copied, but refer to the mapped view, hence they are not
+// zero terminated.
+
+struct IniStr
+{
+    const char* ptr;
+    uint32_t    len;
+};
+
+struct IniEntry
+{
+    IniStr   key;
+    IniStr   value;
+    uint32_t line;
+};
+
+struct IniSection
+{
+    IniStr   name;
+    uint32_t line;
+    uint32_t first;  // index of first entry
+    uint32_t count;  // number of entries
+};
+
+struct Ini
+{
+    HANDLE      file;
+    HANDLE      mapping;
+    const char* view;
+    IniSection* sections;
+    uint32_t    num_sections;
+    IniEntry*   entries;
+    uint32_t    num_entries;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -120,6 +425,7 @@ enum DHCP_MESSAGES
     DMSG_REQUEST  = 3,
     DMSG_ACK      = 5,
     DMSG_NAK      = 6,
+    DMSG_RELEASE  = 7,
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -128,10 +434,15 @@ enum DHCP_OPTIONS
 {
     DOPT_PAD               =   0,
     DOPT_SUBNET_MASK       =   1,
+    DOPT_ROUTER            =   3,
     DOPT_REQUESTED_IP_ADDR =  50,
     DOPT_ADDR_LEASE_TIME   =  51,
+    DOPT_OVERLOAD          =  52,
     DOPT_MESSAGE_TYPE      =  53,
     DOPT_SERVER_IDENT      =  54,
+    DOPT_VENDOR_CLASS      =  60,
+    DOPT_CLIENT_IDENT      =  61,
+    DOPT_RELAY_AGENT_INFO  =  82,
     DOPT_END               = 255
 };
 
@@ -139,5 +450,91 @@ enum DHCP_OPTIONS
 
 void send_console_to_tray(PCTSTR title, HICON icon);
 void print_fmt(const char *fmt, ...);
+void dump_stats();
+
+bool ini_load(Ini *ini, const char *path);
+void ini_free(Ini *ini);
+bool ini_error(uint32_t line, const char *msg);
+bool ini_equal(const IniStr& str, const char *sz);
+bool ini_starts_with(const IniStr& str, const char *prefix);
+bool ini_parse_u32(const IniStr& str, uint32_t *result);
+bool ini_parse_bool(const IniStr& str, bool *result);
+bool ini_parse_ip(const IniStr& str, uint32_t *ip);
+
+uint32_t seconds_since_start();
+bool parse_request(Request *req, int size, Config *cfg);
+int prepare_reply(Request *req, Config *cfg, sockaddr_in *to);
+bool commit_reply(Request *req);
+void log_allotted(const Request *req);
+void print_config(const Config& cfg);
+bool open_socket(Config *cfg);
+DWORD WINAPI run_dhcp(void* param);
+int receive_datagram(Request *req, Config *cfg);
+bool transmit_reply(
+    Request *req,
+    Config *cfg,
+    const sockaddr_in& to,
+    int size
+    );
+ConfigTable* load_config(Settings *settings);
+void free_pools(Config *cfg, uint32_t num);
+ConfigTable* config_table();
+void publish_config(ConfigTable *table);
+
+bool parse_options(Request *req);
+
+void lease_snapshot(const Config *cfg, Client *clients);
+bool query_start(const char *pipe_name);
+
+bool run_pipeline(Config *cfg);
+
+bool wild_open(LPFN_WSARECVMSG recv_msg);
+bool wild_serving();
+void wild_run();
+
+bool neigh_start();
+void neigh_add(uint32_t ip, const uint32_t *chaddr, uint32_t expiry);
+void neigh_remove(uint32_t ip);
+
+void sched_init(bool lock_memory);
+void sched_set(uint32_t cpu, uint32_t priority);
+void sched_apply(const Config *cfg);
+void sched_lock(const void *ptr, size_t size);
+void sched_lock_table(const ConfigTable *tbl);
+void sched_unlock(const void *ptr, size_t size);
+void sched_unlock_table(const ConfigTable *tbl);
+
+bool plug_add(Config **cfg, uint32_t count);
+bool plug_remove(Config *cfg);
+void plug_lock();
+void plug_unlock();
+
+bool reload_start(const char *ini_path);
+void reload_request();
+
+bool rio_init();
+void rio_run(Config **cfg, uint32_t count);
+
+bool policy_compile(const Ini *ini, const IniSection *sec, Config *cfg);
+void policy_select(
+    const Config *cfg,
+    const Request *req,
+    uint32_t *first,
+    uint32_t *last
+    );
+
+bool repl_parse(const Ini *ini, const IniSection *sec, Settings *settings);
+bool repl_init(Config *cfg, uint32_t num_cfg, const Settings *settings);
+bool repl_peer_active();
+void repl_run_standby();
+DWORD WINAPI repl_run_active(void* not_used);
+void repl_publish(uint32_t ip, const uint32_t *chaddr, uint32_t expiry);
+
+void stats_init();
+bool stats_start(uint32_t interval);
+void record_latency(LatencyStats *stats, const Request *req);
+void dump_latency(const LatencyStats *stats, uint32_t server_ip);
+void dump_drops(const DropStats *drops);
+void dump_pipe(const PipeStats *pipe);
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,387 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2007-2025 Rocco Matano
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tatdylf.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline char to_lower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static IniStr trim(const char *begin, const char *end)
+{
+    while (begin < end && is_blank(*begin)) begin++;
+    while (end > begin && is_blank(end[-1])) end--;
+    IniStr str;
+    str.ptr = begin;
+    str.len = static_cast<uint32_t>(end - begin);
+    return str;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool grow(void **arr, uint32_t *capacity, uint32_t count, size_t size)
+{
+    if (count < *capacity)
+    {
+        return true;
+    }
+    const uint32_t new_cap = *capacity ? *capacity * 2 : 16;
+    void *new_arr = mem_realloc(*arr, new_cap * size);
+    if (new_arr == nullptr)
+    {
+        return false;
+    }
+    *arr = new_arr;
+    *capacity = new_cap;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool same_name(const IniStr& a, const IniStr& b)
+{
+    if (a.len != b.len)
+    {
+        return false;
+    }
+    for (uint32_t idx = 0; idx < a.len; idx++)
+    {
+        if (to_lower(a.ptr[idx]) != to_lower(b.ptr[idx]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ini_error(uint32_t line, const char *msg)
+{
+    print_fmt("ini line %u: %s\n", line, msg);
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Much like GetPrivateProfileString we accept comments starting with ';'
+// or '#', also after the ']' of a section, ignore blanks around names and
+// values and treat names as case insensitive. Unlike
+// GetPrivateProfileString we insist on every line being well-formed.
+
+static bool tokenize(Ini *ini, const char *text, uint32_t size)
+{
+    uint32_t sec_cap = 0;
+    uint32_t ent_cap = 0;
+    const char *p = text;
+    const char *const end = text + size;
+
+    // skip UTF-8 BOM
+    const uint8_t *bom = reinterpret_cast<const uint8_t*>(p);
+    if (size >= 3 && bom[0] == 0xef && bom[1] == 0xbb && bom[2] == 0xbf)
+    {
+        p += 3;
+    }
+
+    for (uint32_t line = 1; p < end; line++)
+    {
+        const char *eol = p;
+        while (eol < end && *eol != '\n') eol++;
+        const IniStr str = trim(p, eol);
+        p = eol < end ? eol + 1 : end;
+
+        if (str.len == 0 || str.ptr[0] == ';' || str.ptr[0] == '#')
+        {
+            continue;
+        }
+
+        if (str.ptr[0] == '[')
+        {
+            const char *close = str.ptr + 1;
+            while (close < str.ptr + str.len && *close != ']') close++;
+            if (close == str.ptr + str.len)
+            {
+                return ini_error(line, "missing ']'");
+            }
+            const IniStr rest = trim(close + 1, str.ptr + str.len);
+            if (rest.len != 0 && rest.ptr[0] != ';' && rest.ptr[0] != '#')
+            {
+                return ini_error(line, "text after ']'");
+            }
+            const IniStr name = trim(str.ptr + 1, close);
+            if (name.len == 0)
+            {
+                return ini_error(line, "empty section name");
+            }
+            for (uint32_t idx = 0; idx < ini->num_sections; idx++)
+            {
+                if (same_name(ini->sections[idx].name, name))
+                {
+                    return ini_error(line, "duplicate section");
+                }
+            }
+            if (!grow(
+                reinterpret_cast<void**>(&ini->sections),
+                &sec_cap,
+                ini->num_sections,
+                sizeof(IniSection)
+                ))
+            {
+                return ini_error(line, "out of memory");
+            }
+            IniSection &sec = ini->sections[ini->num_sections++];
+            sec.name = name;
+            sec.line = line;
+            sec.first = ini->num_entries;
+            sec.count = 0;
+            continue;
+        }
+
+        const char *eq = str.ptr;
+        while (eq < str.ptr + str.len && *eq != '=') eq++;
+        if (eq == str.ptr + str.len)
+        {
+            return ini_error(line, "missing '='");
+        }
+        if (ini->num_sections == 0)
+        {
+            return ini_error(line, "key outside of section");
+        }
+        const IniStr key = trim(str.ptr, eq);
+        if (key.len == 0)
+        {
+            return ini_error(line, "empty key");
+        }
+        if (!grow(
+            reinterpret_cast<void**>(&ini->entries),
+            &ent_cap,
+            ini->num_entries,
+            sizeof(IniEntry)
+            ))
+        {
+            return ini_error(line, "out of memory");
+        }
+        IniEntry &entry = ini->entries[ini->num_entries++];
+        entry.key = key;
+        entry.value = trim(eq + 1, str.ptr + str.len);
+        entry.line = line;
+        ini->sections[ini->num_sections - 1].count++;
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ini_load(Ini *ini, const char *path)
+{
+    zero_init(*ini);
+    ini->file = CreateFile(
+        path,
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr
+        );
+    if (ini->file == INVALID_HANDLE_VALUE)
+    {
+        print_fmt("cannot open %s\n", path);
+        return false;
+    }
+
+    DWORD size_hi = 0;
+    const DWORD size = GetFileSize(ini->file, &size_hi);
+    if (size_hi != 0 || size == INVALID_FILE_SIZE)
+    {
+        print_fmt("bad size of %s\n", path);
+        ini_free(ini);
+        return false;
+    }
+    if (size == 0)
+    {
+        // cannot map an empty file, but there is nothing to parse anyway
+        return true;
+    }
+
+    ini->mapping = CreateFileMapping(
+        ini->file,
+        nullptr,
+        PAGE_READONLY,
+        0,
+        0,
+        nullptr
+        );
+    if (ini->mapping != nullptr)
+    {
+        ini->view = static_cast<const char*>(
+            MapViewOfFile(ini->mapping, FILE_MAP_READ, 0, 0, 0)
+            );
+    }
+    if (ini->view == nullptr)
+    {
+        print_fmt("cannot map %s\n", path);
+        ini_free(ini);
+        return false;
+    }
+
+    if (!tokenize(ini, ini->view, size))
+    {
+        ini_free(ini);
+        return false;
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void ini_free(Ini *ini)
+{
+    mem_free(ini->entries);
+    mem_free(ini->sections);
+    if (ini->view != nullptr)
+    {
+        UnmapViewOfFile(ini->view);
+    }
+    if (ini->mapping != nullptr)
+    {
+        CloseHandle(ini->mapping);
+    }
+    if (ini->file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(ini->file);
+    }
+    zero_init(*ini);
+    ini->file = INVALID_HANDLE_VALUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ini_starts_with(const IniStr& str, const char *prefix)
+{
+    uint32_t idx = 0;
+    for (; prefix[idx] != 0; idx++)
+    {
+        if (idx >= str.len || to_lower(str.ptr[idx]) != prefix[idx])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ini_equal(const IniStr& str, const char *sz)
+{
+    return str.len == sz_len(sz) && ini_starts_with(str, sz);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ini_parse_u32(const IniStr& str, uint32_t *result)
+{
+    if (str.len == 0)
+    {
+        return false;
+    }
+    uint32_t accu = 0;
+    for (uint32_t idx = 0; idx < str.len; idx++)
+    {
+        const uint32_t digit = static_cast<uint32_t>(str.ptr[idx] - '0');
+        if (digit > 9 || accu > (UINT32_MAX - digit) / 10)
+        {
+            return false;
+        }
+        accu = accu * 10 + digit;
+    }
+    *result = accu;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ini_parse_bool(const IniStr& str, bool *result)
+{
+    uint32_t val;
+    if (!ini_parse_u32(str, &val) || val > 1)
+    {
+        return false;
+    }
+    *result = val != 0;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ini_parse_ip(const IniStr& str, uint32_t *ip)
+{
+    // strict dotted quad; the result is in network byte order
+    uint32_t result = 0;
+    uint32_t pos = 0;
+    for (uint32_t part = 0; part < 4; part++)
+    {
+        if (part > 0)
+        {
+            if (pos >= str.len || str.ptr[pos++] != '.')
+            {
+                return false;
+            }
+        }
+        IniStr num;
+        num.ptr = str.ptr + pos;
+        num.len = 0;
+        while (pos < str.len && str.ptr[pos] != '.' && num.len < 4)
+        {
+            pos++;
+            num.len++;
+        }
+        uint32_t val;
+        if (num.len > 3 || !ini_parse_u32(num, &val) || val > 255)
+        {
+            return false;
+        }
+        result = (result << 8) | val;
+    }
+    if (pos != str.len)
+    {
+        return false;
+    }
+    *ip = htonl(result);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
@@ -61,9 +61,122 @@
 #include <shellapi.h>
 
 #include <winsock2.h>
+#include <mswsock.h>
+#include <ws2ipdef.h>
+#include <iphlpapi.h>
 #include <stdlib.h>
 #include <stdio.h>
 
+// Receive timestamps are available since Windows 10 2004, but older SDKs do
+// not know about them.
+#ifndef SIO_TIMESTAMPING
+#define SIO_TIMESTAMPING _WSAIOW(IOC_VENDOR, 235)
+#define SO_TIMESTAMP 0x300A
+#define TIMESTAMPING_FLAG_RX 0x1
+typedef struct _TIMESTAMPING_CONFIG
+{
+    ULONG Flags;
+    USHORT TxTimestampsBuffered;
+} TIMESTAMPING_CONFIG;
+#endif
+
+// Registered I/O is available since Windows 8. Since we target Vista, the SDK
+// hides its declarations even if it knows about them.
+#ifndef RIO_CORRUPT_CQ
+#define WSA_FLAG_REGISTERED_IO 0x100
+#define SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER _WSAIORW(IOC_WS2, 36)
+#define WSAID_MULTIPLE_RIO \
+    {0x8509e081, 0x96dd, 0x4005, \
+    {0xb1, 0x65, 0x9e, 0x2e, 0xe8, 0xc7, 0x9e, 0x3f}}
+#define RIO_MSG_DONT_NOTIFY 0x1
+#define RIO_MSG_DEFER 0x2
+#define RIO_MSG_WAITALL 0x4
+#define RIO_MSG_COMMIT_ONLY 0x8
+#define RIO_INVALID_BUFFERID ((RIO_BUFFERID)0xFFFFFFFF)
+#define RIO_INVALID_CQ ((RIO_CQ)0)
+#define RIO_INVALID_RQ ((RIO_RQ)0)
+#define RIO_CORRUPT_CQ 0xFFFFFFFF
+typedef struct RIO_BUFFERID_t *RIO_BUFFERID;
+typedef struct RIO_CQ_t *RIO_CQ;
+typedef struct RIO_RQ_t *RIO_RQ;
+typedef struct _RIORESULT
+{
+    LONG Status;
+    ULONG BytesTransferred;
+    ULONGLONG SocketContext;
+    ULONGLONG RequestContext;
+} RIORESULT, *PRIORESULT;
+typedef struct _RIO_BUF
+{
+    RIO_BUFFERID BufferId;
+    ULONG Offset;
+    ULONG Length;
+} RIO_BUF, *PRIO_BUF;
+typedef enum _RIO_NOTIFICATION_COMPLETION_TYPE
+{
+    RIO_EVENT_COMPLETION = 1,
+    RIO_IOCP_COMPLETION = 2,
+} RIO_NOTIFICATION_COMPLETION_TYPE;
+typedef struct _RIO_NOTIFICATION_COMPLETION
+{
+    RIO_NOTIFICATION_COMPLETION_TYPE Type;
+    union
+    {
+        struct
+        {
+            HANDLE EventHandle;
+            BOOL NotifyReset;
+        } Event;
+        struct
+        {
+            HANDLE IocpHandle;
+            PVOID CompletionKey;
+            PVOID Overlapped;
+        } Iocp;
+    };
+} RIO_NOTIFICATION_COMPLETION, *PRIO_NOTIFICATION_COMPLETION;
+typedef BOOL (PASCAL *LPFN_RIORECEIVE)(RIO_RQ, PRIO_BUF, ULONG, DWORD, PVOID);
+typedef int (PASCAL *LPFN_RIORECEIVEEX)(
+    RIO_RQ, PRIO_BUF, ULONG, PRIO_BUF, PRIO_BUF, PRIO_BUF, PRIO_BUF, DWORD,
+    PVOID
+    );
+typedef BOOL (PASCAL *LPFN_RIOSEND)(RIO_RQ, PRIO_BUF, ULONG, DWORD, PVOID);
+typedef BOOL (PASCAL *LPFN_RIOSENDEX)(
+    RIO_RQ, PRIO_BUF, ULONG, PRIO_BUF, PRIO_BUF, PRIO_BUF, PRIO_BUF, DWORD,
+    PVOID
+    );
+typedef VOID (PASCAL *LPFN_RIOCLOSECOMPLETIONQUEUE)(RIO_CQ);
+typedef RIO_CQ (PASCAL *LPFN_RIOCREATECOMPLETIONQUEUE)(
+    DWORD, PRIO_NOTIFICATION_COMPLETION
+    );
+typedef RIO_RQ (PASCAL *LPFN_RIOCREATEREQUESTQUEUE)(
+    SOCKET, ULONG, ULONG, ULONG, ULONG, RIO_CQ, RIO_CQ, PVOID
+    );
+typedef ULONG (PASCAL *LPFN_RIODEQUEUECOMPLETION)(RIO_CQ, PRIORESULT, ULONG);
+typedef VOID (PASCAL *LPFN_RIODEREGISTERBUFFER)(RIO_BUFFERID);
+typedef INT (PASCAL *LPFN_RIONOTIFY)(RIO_CQ);
+typedef RIO_BUFFERID (PASCAL *LPFN_RIOREGISTERBUFFER)(PCHAR, DWORD);
+typedef BOOL (PASCAL *LPFN_RIORESIZECOMPLETIONQUEUE)(RIO_CQ, DWORD);
+typedef BOOL (PASCAL *LPFN_RIORESIZEREQUESTQUEUE)(RIO_RQ, DWORD, DWORD);
+typedef struct _RIO_EXTENSION_FUNCTION_TABLE
+{
+    DWORD cbSize;
+    LPFN_RIORECEIVE RIOReceive;
+    LPFN_RIORECEIVEEX RIOReceiveEx;
+    LPFN_RIOSEND RIOSend;
+    LPFN_RIOSENDEX RIOSendEx;
+    LPFN_RIOCLOSECOMPLETIONQUEUE RIOCloseCompletionQueue;
+    LPFN_RIOCREATECOMPLETIONQUEUE RIOCreateCompletionQueue;
+    LPFN_RIOCREATEREQUESTQUEUE RIOCreateRequestQueue;
+    LPFN_RIODEQUEUECOMPLETION RIODequeueCompletion;
+    LPFN_RIODEREGISTERBUFFER RIODeregisterBuffer;
+    LPFN_RIONOTIFY RIONotify;
+    LPFN_RIOREGISTERBUFFER RIORegisterBuffer;
+    LPFN_RIORESIZECOMPLETIONQUEUE RIOResizeCompletionQueue;
+    LPFN_RIORESIZEREQUESTQUEUE RIOResizeRequestQueue;
+} RIO_EXTENSION_FUNCTION_TABLE, *PRIO_EXTENSION_FUNCTION_TABLE;
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 
 #if defined(_MSC_VER) && (_MSC_VER < 1600)
@@ -134,6 +247,48 @@ void FORCEINLINE mem_cpy(void* dst, const void* src, size_t size)
 #endif
 }
 
+void FORCEINLINE mem_zero(void* dst, size_t size)
+{
+#if defined(_M_IX86) || defined(_M_AMD64)
+    __stosb(static_cast<BYTE*>(dst), 0, size);
+#else
+    memset(dst, 0, size);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Data that is written by different threads should not share a cache line.
+
+#define CACHE_ALIGNED __declspec(align(64))
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Since we do not initialize the CRT, malloc & co. are off limits. All dynamic
+// memory is zero initialized.
+
+inline void* mem_alloc(size_t size)
+{
+    return HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, size);
+}
+
+inline void* mem_realloc(void* ptr, size_t size)
+{
+    return (
+        ptr ?
+        HeapReAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, ptr, size) :
+        mem_alloc(size)
+        );
+}
+
+inline void mem_free(void* ptr)
+{
+    if (ptr)
+    {
+        HeapFree(GetProcessHeap(), 0, ptr);
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 uint32_t inline sz_len(const char* str)
@@ -0,0 +1,334 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2007-2025 Rocco Matano
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Neighbor entries for the cameras. As soon as a lease is committed, the
+// address and MAC of the camera are entered into the neighbor (ARP) cache of
+// its interface, so that the first packet of the host to the camera does not
+// have to wait for an ARP round trip. The entry is removed again once the
+// lease has expired or was released.
+//
+// The serving threads only queue the changes. A worker takes all queued
+// changes at once and applies them, skipping renewals of entries that are
+// already there. The entries are added as reachable instead of permanent:
+// if tatdylf is gone, the OS ages them out by itself.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tatdylf.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const DWORD SWEEP_MS = 10000;  // check for expired leases
+static const uint32_t MAC_SIZE = 6;
+
+enum NEIGH_OPS
+{
+    NEIGH_ADD,
+    NEIGH_REMOVE,
+};
+
+struct NeighOp
+{
+    uint32_t ip;      // network byte order
+    uint32_t expiry;  // seconds_since_start
+    uint8_t  op;
+    uint8_t  mac[MAC_SIZE];
+};
+
+struct Neighbor
+{
+    uint32_t ip;
+    uint32_t expiry;
+    NET_IFINDEX ifindex;
+    uint8_t  mac[MAC_SIZE];
+};
+
+struct OpQueue
+{
+    NeighOp  *ops;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+static volatile bool enabled = false;
+static volatile bool adds_denied = false;  // removing may still work
+static SRWLOCK lock = SRWLOCK_INIT;  // guards 'pending'
+static HANDLE wake = nullptr;
+static OpQueue pending;
+static OpQueue spare;  // swapped with 'pending' by the worker
+
+// owned by the worker
+static Neighbor *installed = nullptr;
+static uint32_t num_installed = 0;
+static uint32_t cap_installed = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void enqueue(
+    uint8_t op,
+    uint32_t ip,
+    const uint32_t *chaddr,
+    uint32_t expiry
+    )
+{
+    if (!enabled)
+    {
+        return;
+    }
+    AcquireSRWLockExclusive(&lock);
+    if (pending.count == pending.capacity)
+    {
+        const uint32_t new_cap = pending.capacity ? pending.capacity * 2 : 64;
+        void *ops = mem_realloc(pending.ops, new_cap * sizeof(NeighOp));
+        if (ops == nullptr)
+        {
+            // the entries are merely an optimization
+            ReleaseSRWLockExclusive(&lock);
+            return;
+        }
+        pending.ops = static_cast<NeighOp*>(ops);
+        pending.capacity = new_cap;
+    }
+    NeighOp &entry = pending.ops[pending.count++];
+    entry.op = op;
+    entry.ip = ip;
+    entry.expiry = expiry;
+    if (chaddr != nullptr)
+    {
+        mem_cpy(entry.mac, chaddr, MAC_SIZE);
+    }
+    ReleaseSRWLockExclusive(&lock);
+    SetEvent(wake);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void neigh_add(uint32_t ip, const uint32_t *chaddr, uint32_t expiry)
+{
+    enqueue(NEIGH_ADD, ip, chaddr, expiry);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void neigh_remove(uint32_t ip)
+{
+    enqueue(NEIGH_REMOVE, ip, nullptr, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void init_row(MIB_IPNET_ROW2 *row, const Neighbor& nb)
+{
+    zero_init(*row);
+    row->Address.Ipv4.sin_family = AF_INET;
+    row->Address.Ipv4.sin_addr.s_addr = nb.ip;
+    row->InterfaceIndex = nb.ifindex;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void report(const char *what, uint32_t ip, DWORD err)
+{
+    in_addr inaddr;
+    inaddr.S_un.S_addr = ip;
+    print_fmt("cannot %s neighbor %s: %u\n", what, inet_ntoa(inaddr), err);
+    if (err == ERROR_ACCESS_DENIED)
+    {
+        // Not running as administrator, no point in adding more. Entries
+        // that are there already are still removed when their lease ends.
+        adds_denied = true;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void install(const Neighbor& nb)
+{
+    MIB_IPNET_ROW2 row;
+    init_row(&row, nb);
+    mem_cpy(row.PhysicalAddress, nb.mac, MAC_SIZE);
+    row.PhysicalAddressLength = MAC_SIZE;
+    row.State = NlnsReachable;
+    DWORD err = CreateIpNetEntry2(&row);
+    if (err == ERROR_OBJECT_ALREADY_EXISTS)
+    {
+        err = SetIpNetEntry2(&row);
+    }
+    if (err != NO_ERROR)
+    {
+        report("add", nb.ip, err);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void uninstall(uint32_t idx)
+{
+    const Neighbor &nb = installed[idx];
+    MIB_IPNET_ROW2 row;
+    init_row(&row, nb);
+    const DWORD err = DeleteIpNetEntry2(&row);
+    if (err != NO_ERROR && err != ERROR_NOT_FOUND)
+    {
+        report("remove", nb.ip, err);
+    }
+    installed[idx] = installed[--num_installed];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int find(uint32_t ip)
+{
+    for (uint32_t idx = 0; idx < num_installed; idx++)
+    {
+        if (installed[idx].ip == ip)
+        {
+            return static_cast<int>(idx);
+        }
+    }
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void apply_add(const NeighOp& op)
+{
+    const int found = find(op.ip);
+    if (found >= 0)
+    {
+        Neighbor &nb = installed[found];
+        nb.expiry = op.expiry;
+        bool same = true;
+        for (uint32_t pos = 0; pos < MAC_SIZE; pos++)
+        {
+            same = same && nb.mac[pos] == op.mac[pos];
+        }
+        if (!same && !adds_denied)
+        {
+            // another camera got the address of an expired lease
+            mem_cpy(nb.mac, op.mac, MAC_SIZE);
+            install(nb);
+        }
+        return;
+    }
+
+    if (adds_denied)
+    {
+        return;
+    }
+    DWORD ifindex;
+    if (GetBestInterface(op.ip, &ifindex) != NO_ERROR)
+    {
+        return;
+    }
+    if (num_installed == cap_installed)
+    {
+        const uint32_t new_cap = cap_installed ? cap_installed * 2 : 64;
+        void *grown = mem_realloc(installed, new_cap * sizeof(Neighbor));
+        if (grown == nullptr)
+        {
+            return;
+        }
+        installed = static_cast<Neighbor*>(grown);
+        cap_installed = new_cap;
+    }
+    Neighbor &nb = installed[num_installed++];
+    nb.ip = op.ip;
+    nb.expiry = op.expiry;
+    nb.ifindex = ifindex;
+    mem_cpy(nb.mac, op.mac, MAC_SIZE);
+    install(nb);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static DWORD WINAPI run_neighbors(void*)
+{
+    for (;;)
+    {
+        WaitForSingleObject(wake, SWEEP_MS);
+
+        AcquireSRWLockExclusive(&lock);
+        OpQueue batch = pending;
+        pending = spare;
+        pending.count = 0;
+        ReleaseSRWLockExclusive(&lock);
+
+        for (uint32_t idx = 0; enabled && idx < batch.count; idx++)
+        {
+            const NeighOp &op = batch.ops[idx];
+            if (op.op == NEIGH_ADD)
+            {
+                apply_add(op);
+            }
+            else
+            {
+                const int found = find(op.ip);
+                if (found >= 0)
+                {
+                    uninstall(static_cast<uint32_t>(found));
+                }
+            }
+        }
+        spare = batch;
+
+        const uint32_t now = seconds_since_start();
+        for (uint32_t idx = num_installed; enabled && idx-- > 0;)
+        {
+            if (installed[idx].expiry < now)
+            {
+                uninstall(idx);
+            }
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool neigh_start()
+{
+    wake = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    if (wake == nullptr)
+    {
+        return false;
+    }
+    HANDLE thread = CreateThread(
+        nullptr,
+        0,
+        run_neighbors,
+        nullptr,
+        0,
+        nullptr
+        );
+    if (thread == nullptr)
+    {
+        CloseHandle(wake);
+        return false;
+    }
+    CloseHandle(thread);
+    enabled = true;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,268 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2007-2025 Rocco Matano
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Parsing of the DHCP options of a request. Every option that we are
+// interested in has a handler, which is found through a table that is indexed
+// by the option tag. The table is built by the compiler from the
+// specializations of 'Option<TAG>', so it ends up in read-only data and does
+// not need any initialization at runtime. Supporting another option only
+// requires another specialization.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tatdylf.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+// A handler returns false if the value of the option is malformed.
+
+typedef bool (*OptionHandler)(Request *req, const uint8_t *val, uint32_t len);
+
+template <uint32_t TAG>
+struct Option
+{
+    enum { handled = 0 };
+    static bool handle(Request*, const uint8_t*, uint32_t)
+    {
+        return true;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void set_ref(
+    OptionRef *ref,
+    const Request *req,
+    const uint8_t *val,
+    uint32_t len
+    )
+{
+    ref->offset = static_cast<uint16_t>(
+        reinterpret_cast<const char*>(val) - req->buffer
+        );
+    ref->len = static_cast<uint8_t>(len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+template <>
+struct Option<DOPT_REQUESTED_IP_ADDR>
+{
+    enum { handled = 1 };
+    static bool handle(Request *req, const uint8_t *val, uint32_t len)
+    {
+        if (len != sizeof(req->requested_ip))
+        {
+            return false;
+        }
+        mem_cpy(&req->requested_ip, val, sizeof(req->requested_ip));
+        return true;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+template <>
+struct Option<DOPT_OVERLOAD>
+{
+    enum { handled = 1 };
+    static bool handle(Request *req, const uint8_t *val, uint32_t len)
+    {
+        if (len != 1 || *val < 1 || *val > 3)
+        {
+            return false;
+        }
+        req->overload = *val;
+        return true;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+template <>
+struct Option<DOPT_MESSAGE_TYPE>
+{
+    enum { handled = 1 };
+    static bool handle(Request *req, const uint8_t *val, uint32_t len)
+    {
+        if (len != 1)
+        {
+            return false;
+        }
+        req->request_msg = *val;
+        return true;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+template <>
+struct Option<DOPT_SERVER_IDENT>
+{
+    enum { handled = 1 };
+    static bool handle(Request *req, const uint8_t *val, uint32_t len)
+    {
+        if (len != sizeof(req->server_ip))
+        {
+            return false;
+        }
+        mem_cpy(&req->server_ip, val, sizeof(req->server_ip));
+        return true;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+template <>
+struct Option<DOPT_VENDOR_CLASS>
+{
+    enum { handled = 1 };
+    static bool handle(Request *req, const uint8_t *val, uint32_t len)
+    {
+        set_ref(&req->vendor_class, req, val, len);
+        return true;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+template <>
+struct Option<DOPT_CLIENT_IDENT>
+{
+    enum { handled = 1 };
+    static bool handle(Request *req, const uint8_t *val, uint32_t len)
+    {
+        set_ref(&req->client_id, req, val, len);
+        return true;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+template <>
+struct Option<DOPT_RELAY_AGENT_INFO>
+{
+    enum { handled = 1 };
+    static bool handle(Request *req, const uint8_t *val, uint32_t len)
+    {
+        // The options area is reused for the reply, so this one has to be
+        // copied.
+        mem_cpy(req->relay_info, val, len);
+        req->relay_info_len = static_cast<uint8_t>(len);
+        return true;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define OPT_1(n)   (Option<(n)>::handled ? &Option<(n)>::handle : nullptr),
+#define OPT_4(n)   OPT_1(n) OPT_1((n) + 1) OPT_1((n) + 2) OPT_1((n) + 3)
+#define OPT_16(n)  OPT_4(n) OPT_4((n) + 4) OPT_4((n) + 8) OPT_4((n) + 12)
+#define OPT_64(n)  OPT_16(n) OPT_16((n) + 16) OPT_16((n) + 32) OPT_16((n) + 48)
+#define OPT_256(n) \
+    OPT_64(n) OPT_64((n) + 64) OPT_64((n) + 128) OPT_64((n) + 192)
+
+static const OptionHandler HANDLERS[256] = { OPT_256(0) };
+
+#undef OPT_256
+#undef OPT_64
+#undef OPT_16
+#undef OPT_4
+#undef OPT_1
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Walks the options in [src, end). Returns false if an option runs past 'end'
+// or is rejected by its handler. Reaching 'end' without DOPT_END is tolerated.
+
+static bool parse_area(Request *req, const uint8_t *src, const uint8_t *end)
+{
+    while (src < end)
+    {
+        const uint8_t tag = *src++;
+        if (tag == DOPT_END)
+        {
+            break;
+        }
+        if (tag == DOPT_PAD)
+        {
+            continue;
+        }
+        if (src >= end)
+        {
+            return false;
+        }
+        const uint32_t len = *src++;
+        if (len > static_cast<uint32_t>(end - src))
+        {
+            return false;
+        }
+        const OptionHandler handler = HANDLERS[tag];
+        if (handler != nullptr && !handler(req, src, len))
+        {
+            return false;
+        }
+        src += len;
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool parse_options(Request *req)
+{
+    const uint8_t *base = reinterpret_cast<const uint8_t*>(req->buffer);
+    const uint8_t *end = base + req->size;
+
+    if (!parse_area(req, req->packet.options, end))
+    {
+        return false;
+    }
+
+    // RFC 2131 4.1: with option overload 'file' is parsed before 'sname'.
+    // Both must not contain another overload option.
+    const uint8_t overload = req->overload;
+    if (overload & 1)
+    {
+        const uint8_t *file = req->packet.file;
+        if (!parse_area(req, file, file + sizeof(req->packet.file)))
+        {
+            return false;
+        }
+    }
+    if (overload & 2)
+    {
+        const uint8_t *sname = reinterpret_cast<const uint8_t*>(
+            req->packet.sname
+            );
+        if (!parse_area(req, sname, sname + sizeof(req->packet.sname)))
+        {
+            return false;
+        }
+    }
+    req->overload = overload;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,320 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2007-2025 Rocco Matano
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Pipelined serving of one interface. Instead of a single thread that
+// receives, processes and sends every request in turn, three threads do one
+// of these stages each:
+//
+//   receive  takes a free slot, receives a datagram into it
+//   process  parses the request and prepares the reply with the pool locked
+//   send     sends the reply, commits the lease and returns the slot
+//
+// The PIPE_SLOTS slots of a pipeline are allocated once and travel between
+// the stages through single producer/single consumer rings, that are
+// cache-aligned so that the producer and the consumer of a ring do not write
+// to the same cache line. Since every ring can hold all the slots, pushing
+// never fails. A consumer spins for a while before it waits for an event,
+// which the producer only signals if the consumer is actually waiting.
+//
+// Whenever a slot is taken out of a ring, the number of slots that were in
+// it is recorded in the PipeStats of the interface.
+//
+// All three threads get the CPU and priority of the interface.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tatdylf.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const uint32_t RING_SPINS = 1024;
+
+struct PipeSlot
+{
+    Request     req;
+    sockaddr_in to;
+    int         size;  // of the datagram, then of the reply (0 if none)
+};
+
+struct Ring
+{
+    CACHE_ALIGNED volatile uint32_t head;    // written by the consumer
+    CACHE_ALIGNED volatile uint32_t tail;    // written by the producer
+    volatile bool                   closed;  // no more pushes
+    CACHE_ALIGNED volatile LONG     waiting; // consumer waits for the event
+    HANDLE                          event;
+    CACHE_ALIGNED PipeSlot          *items[PIPE_SLOTS];
+};
+
+struct Pipeline
+{
+    Ring     rings[NUM_RINGS];
+    PipeSlot slots[PIPE_SLOTS];
+    Config   *cfg;  // the one the pipeline was started with
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void push(Ring *ring, PipeSlot *slot)
+{
+    const uint32_t tail = ring->tail;
+    ring->items[tail % PIPE_SLOTS] = slot;
+    _ReadWriteBarrier();
+    ring->tail = tail + 1;
+
+    // The store of 'tail' must be visible before 'waiting' is read, or we
+    // could miss a consumer that has just found the ring empty.
+    MemoryBarrier();
+    if (ring->waiting)
+    {
+        SetEvent(ring->event);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void close_ring(Ring *ring)
+{
+    ring->closed = true;
+    MemoryBarrier();
+    if (ring->waiting)
+    {
+        SetEvent(ring->event);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns nullptr once the ring has been closed and drained.
+
+static PipeSlot* pop(Pipeline *pipe, uint32_t which)
+{
+    Ring *ring = &pipe->rings[which];
+    const uint32_t head = ring->head;
+    for (uint32_t spins = 0;; spins++)
+    {
+        // 'closed' is set after the last push, so it has to be read first.
+        const bool closed = ring->closed;
+        _ReadWriteBarrier();
+        const uint32_t tail = ring->tail;
+        if (tail != head)
+        {
+            PipeSlot *slot = ring->items[head % PIPE_SLOTS];
+            _ReadWriteBarrier();
+            ring->head = head + 1;
+            current_config(pipe->cfg)->pipe.counts[which][tail - head]++;
+            return slot;
+        }
+        if (closed)
+        {
+            return nullptr;
+        }
+        if (spins < RING_SPINS)
+        {
+            YieldProcessor();
+            continue;
+        }
+
+        InterlockedExchange(&ring->waiting, 1);
+        if (ring->tail == head && !ring->closed)
+        {
+            WaitForSingleObject(ring->event, INFINITE);
+        }
+        ring->waiting = 0;
+        spins = 0;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline Config* stage_config(Pipeline *pipe, const Config **applied)
+{
+    Config *cfg = current_config(pipe->cfg);
+    if (cfg != *applied)
+    {
+        sched_apply(cfg);
+        *applied = cfg;
+    }
+    return cfg;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static DWORD WINAPI process_stage(void *param)
+{
+    Pipeline *pipe = static_cast<Pipeline*>(param);
+    const Config *applied = nullptr;
+    stage_config(pipe, &applied);
+    PipeSlot *slot;
+    while ((slot = pop(pipe, RING_RX)) != nullptr)
+    {
+        Config *cfg = stage_config(pipe, &applied);
+        const int size = slot->size;
+        slot->size = 0;
+        if (parse_request(&slot->req, size, cfg))
+        {
+            slot->size = prepare_reply(&slot->req, cfg, &slot->to);
+        }
+        push(&pipe->rings[RING_TX], slot);
+    }
+    close_ring(&pipe->rings[RING_TX]);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// A lease is only extended once its ACK has been sent, so commit_reply is
+// called here and not by the processing stage.
+
+static DWORD WINAPI send_stage(void *param)
+{
+    Pipeline *pipe = static_cast<Pipeline*>(param);
+    const Config *applied = nullptr;
+    stage_config(pipe, &applied);
+    PipeSlot *slot;
+    while ((slot = pop(pipe, RING_TX)) != nullptr)
+    {
+        Config *cfg = stage_config(pipe, &applied);
+        if (
+            slot->size > 0 &&
+            transmit_reply(&slot->req, cfg, slot->to, slot->size)
+            )
+        {
+            log_allotted(&slot->req);
+        }
+        push(&pipe->rings[RING_FREE], slot);
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// 'threads' holds the processing and the send thread, either may be nullptr.
+
+static void shut_down(Pipeline *pipe, HANDLE *threads)
+{
+    close_ring(&pipe->rings[RING_RX]);
+    if (threads[0] == nullptr)
+    {
+        // otherwise the processing thread does this once it is done
+        close_ring(&pipe->rings[RING_TX]);
+    }
+    for (uint32_t idx = 0; idx < 2; idx++)
+    {
+        if (threads[idx] != nullptr)
+        {
+            WaitForSingleObject(threads[idx], INFINITE);
+            CloseHandle(threads[idx]);
+        }
+    }
+    for (uint32_t idx = 0; idx < NUM_RINGS; idx++)
+    {
+        if (pipe->rings[idx].event != nullptr)
+        {
+            CloseHandle(pipe->rings[idx].event);
+        }
+    }
+    VirtualFree(pipe, 0, MEM_RELEASE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns false if the pipeline could not be set up. Otherwise it returns
+// once the socket has been closed by hot-plug or a reload. The calling thread
+// becomes the receive stage.
+
+bool run_pipeline(Config *cfg)
+{
+    // VirtualAlloc returns zeroed pages, which satisfy the alignment of the
+    // rings.
+    Pipeline *pipe = static_cast<Pipeline*>(VirtualAlloc(
+        nullptr,
+        sizeof(Pipeline),
+        MEM_COMMIT | MEM_RESERVE,
+        PAGE_READWRITE
+        ));
+    if (pipe == nullptr)
+    {
+        print_fmt("pipeline setup failed: %u\n", GetLastError());
+        return false;
+    }
+    pipe->cfg = cfg;
+    Ring *free_slots = &pipe->rings[RING_FREE];
+    for (uint32_t idx = 0; idx < PIPE_SLOTS; idx++)
+    {
+        // touch the pages before the first datagram arrives
+        zero_init(pipe->slots[idx].req);
+        free_slots->items[idx] = &pipe->slots[idx];
+    }
+    free_slots->tail = PIPE_SLOTS;
+    sched_lock(pipe, sizeof(Pipeline));
+
+    HANDLE threads[2] = { nullptr, nullptr };
+    bool ok = true;
+    for (uint32_t idx = 0; idx < NUM_RINGS; idx++)
+    {
+        pipe->rings[idx].event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        ok = ok && pipe->rings[idx].event != nullptr;
+    }
+    if (ok)
+    {
+        threads[0] = CreateThread(nullptr, 0, process_stage, pipe, 0, nullptr);
+    }
+    if (threads[0] != nullptr)
+    {
+        threads[1] = CreateThread(nullptr, 0, send_stage, pipe, 0, nullptr);
+    }
+    if (threads[1] == nullptr)
+    {
+        print_fmt("pipeline setup failed: %u\n", GetLastError());
+        shut_down(pipe, threads);
+        return false;
+    }
+
+    // A slot is kept across receive errors.
+    PipeSlot *slot = nullptr;
+    const Config *applied = nullptr;
+    for (;;)
+    {
+        cfg = stage_config(pipe, &applied);
+        if (const_cast<volatile SOCKET&>(cfg->socket) == INVALID_SOCKET)
+        {
+            break;
+        }
+        if (slot == nullptr)
+        {
+            slot = pop(pipe, RING_FREE);
+        }
+        slot->size = receive_datagram(&slot->req, cfg);
+        if (slot->size != SOCKET_ERROR)
+        {
+            push(&pipe->rings[RING_RX], slot);
+            slot = nullptr;
+        }
+    }
+    shut_down(pipe, threads);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
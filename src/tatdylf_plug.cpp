@@ -0,0 +1,333 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2007-2025 Rocco Matano
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Hot-plug of interfaces. An interface can only be served while its address
+// is assigned, but camera NICs are often enabled after tatdylf has been
+// started, and cables get unplugged. Windows notifies us about changes of
+// unicast addresses and of the link state of interfaces, so the socket of an
+// interface is opened as soon as its address is usable and closed once it
+// is gone, without any polling.
+//
+// Every interface that is managed here is served by a thread of its own
+// (run_dhcp), which ends when its socket is closed. Since a reload replaces
+// the Config of an interface, we always act on the current one.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tatdylf.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct PlugIface
+{
+    Config      *cfg;
+    NET_IFINDEX ifindex;  // 0 while unknown
+    HANDLE      thread;   // nullptr while not served
+};
+
+static PlugIface *ifaces = nullptr;
+static uint32_t num_ifaces = 0;
+static bool subscribed = false;
+
+// Notifications may be delivered concurrently, and a reload must not move
+// a socket while it is being opened or closed.
+static SRWLOCK lock = SRWLOCK_INIT;
+
+////////////////////////////////////////////////////////////////////////////////
+
+void plug_lock()
+{
+    AcquireSRWLockExclusive(&lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void plug_unlock()
+{
+    ReleaseSRWLockExclusive(&lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void bring_up(PlugIface *iface)
+{
+    if (iface->thread != nullptr)
+    {
+        return;
+    }
+    Config *cfg = current_config(iface->cfg);
+    if (cfg->socket == INVALID_SOCKET && !open_socket(cfg))
+    {
+        return;
+    }
+    iface->thread = CreateThread(nullptr, 0, run_dhcp, cfg, 0, nullptr);
+    if (iface->thread == nullptr)
+    {
+        closesocket(cfg->socket);
+        cfg->socket = INVALID_SOCKET;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void bring_down(PlugIface *iface)
+{
+    if (iface->thread == nullptr)
+    {
+        return;
+    }
+    Config *cfg = current_config(iface->cfg);
+    const SOCKET sock = cfg->socket;
+    cfg->socket = INVALID_SOCKET;
+
+    // This lets the pending receive of the thread fail, so it will see the
+    // invalid socket and end.
+    closesocket(sock);
+    WaitForSingleObject(iface->thread, INFINITE);
+    CloseHandle(iface->thread);
+    iface->thread = nullptr;
+
+    in_addr inaddr;
+    inaddr.S_un.S_addr = cfg->server_ip;
+    print_fmt("lost %s\n", inet_ntoa(inaddr));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool is_usable(const PlugIface *iface)
+{
+    if (iface->ifindex == 0)
+    {
+        return false;
+    }
+
+    MIB_IPINTERFACE_ROW link;
+    zero_init(link);
+    link.Family = AF_INET;
+    link.InterfaceIndex = iface->ifindex;
+    if (GetIpInterfaceEntry(&link) != NO_ERROR || !link.Connected)
+    {
+        return false;
+    }
+
+    // A tentative or duplicate address cannot be bound.
+    MIB_UNICASTIPADDRESS_ROW addr;
+    zero_init(addr);
+    addr.Address.Ipv4.sin_family = AF_INET;
+    addr.Address.Ipv4.sin_addr.s_addr = iface->cfg->server_ip;
+    addr.InterfaceIndex = iface->ifindex;
+    return (
+        GetUnicastIpAddressEntry(&addr) == NO_ERROR &&
+        addr.DadState == IpDadStatePreferred
+        );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void refresh(PlugIface *iface)
+{
+    if (is_usable(iface))
+    {
+        bring_up(iface);
+    }
+    else
+    {
+        bring_down(iface);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static VOID NETIOAPI_API_ on_address_change(
+    PVOID,
+    PMIB_UNICASTIPADDRESS_ROW row,
+    MIB_NOTIFICATION_TYPE
+    )
+{
+    if (row == nullptr || row->Address.si_family != AF_INET)
+    {
+        return;
+    }
+    const uint32_t ip = row->Address.Ipv4.sin_addr.s_addr;
+    AcquireSRWLockExclusive(&lock);
+    for (uint32_t idx = 0; idx < num_ifaces; idx++)
+    {
+        PlugIface *iface = &ifaces[idx];
+        if (iface->cfg->server_ip == ip)
+        {
+            // the address may have moved to another NIC
+            iface->ifindex = row->InterfaceIndex;
+            refresh(iface);
+        }
+    }
+    ReleaseSRWLockExclusive(&lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static VOID NETIOAPI_API_ on_link_change(
+    PVOID,
+    PMIB_IPINTERFACE_ROW row,
+    MIB_NOTIFICATION_TYPE
+    )
+{
+    if (row == nullptr)
+    {
+        return;
+    }
+    AcquireSRWLockExclusive(&lock);
+    for (uint32_t idx = 0; idx < num_ifaces; idx++)
+    {
+        PlugIface *iface = &ifaces[idx];
+        if (iface->ifindex == row->InterfaceIndex)
+        {
+            refresh(iface);
+        }
+    }
+    ReleaseSRWLockExclusive(&lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool subscribe()
+{
+    HANDLE addr_notify = nullptr;
+    HANDLE link_notify = nullptr;
+    if (
+        NotifyUnicastIpAddressChange(
+            AF_INET,
+            on_address_change,
+            nullptr,
+            FALSE,
+            &addr_notify
+            ) != NO_ERROR ||
+        NotifyIpInterfaceChange(
+            AF_INET,
+            on_link_change,
+            nullptr,
+            FALSE,
+            &link_notify
+            ) != NO_ERROR
+        )
+    {
+        if (addr_notify != nullptr)
+        {
+            CancelMibChangeNotify2(addr_notify);
+        }
+        return false;
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Interfaces whose socket is already open are served right away, the others
+// as soon as their address becomes usable. The caller must not hold the
+// lock.
+
+bool plug_add(Config **cfg, uint32_t count)
+{
+    AcquireSRWLockExclusive(&lock);
+    if (!subscribed)
+    {
+        subscribed = subscribe();
+    }
+    void *grown = nullptr;
+    if (subscribed)
+    {
+        grown = mem_realloc(
+            ifaces,
+            (num_ifaces + count) * sizeof(PlugIface)
+            );
+    }
+    if (grown == nullptr)
+    {
+        ReleaseSRWLockExclusive(&lock);
+        return false;
+    }
+    ifaces = static_cast<PlugIface*>(grown);
+    const uint32_t first = num_ifaces;
+    for (uint32_t idx = 0; idx < count; idx++)
+    {
+        zero_init(ifaces[first + idx]);
+        ifaces[first + idx].cfg = cfg[idx];
+    }
+    num_ifaces += count;
+
+    // Changes are notified from now on, what is there already has to be
+    // taken from the address table.
+    PMIB_UNICASTIPADDRESS_TABLE table;
+    if (GetUnicastIpAddressTable(AF_INET, &table) == NO_ERROR)
+    {
+        for (ULONG row = 0; row < table->NumEntries; row++)
+        {
+            const MIB_UNICASTIPADDRESS_ROW &addr = table->Table[row];
+            const uint32_t ip = addr.Address.Ipv4.sin_addr.s_addr;
+            for (uint32_t idx = first; idx < num_ifaces; idx++)
+            {
+                if (ifaces[idx].cfg->server_ip == ip)
+                {
+                    ifaces[idx].ifindex = addr.InterfaceIndex;
+                }
+            }
+        }
+        FreeMibTable(table);
+    }
+    for (uint32_t idx = first; idx < num_ifaces; idx++)
+    {
+        PlugIface *iface = &ifaces[idx];
+        if (current_config(iface->cfg)->socket != INVALID_SOCKET)
+        {
+            bring_up(iface);
+        }
+        else
+        {
+            refresh(iface);
+        }
+    }
+    ReleaseSRWLockExclusive(&lock);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Stops serving an interface that has been removed by a reload. Returns
+// false if it is not managed here. The caller must hold the lock.
+
+bool plug_remove(Config *cfg)
+{
+    for (uint32_t idx = 0; idx < num_ifaces; idx++)
+    {
+        PlugIface *iface = &ifaces[idx];
+        if (current_config(iface->cfg) == cfg)
+        {
+            bring_down(iface);
+            ifaces[idx] = ifaces[--num_ifaces];
+            return true;
+        }
+    }
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,466 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2007-2025 Rocco Matano
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Policy rules of a pool have the form
+//
+//     policy = <match> <first>-<last>
+//
+// where <match> is one of
+//
+//     vendor:<text>  option 60 starts with <text>
+//     client:<hex>   option 61 starts with the given bytes
+//     oui:<hex>      the MAC starts with the given three bytes
+//     any            every client
+//
+// and <first>-<last> is a range of last octets within the range of the pool.
+// Rules are tried in the order of the ini file and the first match wins.
+// Clients that match no rule may use the whole pool.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tatdylf.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const uint32_t MAX_RULES = NO_RULE; // rule indices are uint8_t
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline bool is_blank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Pairs of hex digits that may be separated by ':' or '-'.
+
+static bool parse_hex(const IniStr& str, uint8_t *out, uint32_t *len)
+{
+    uint32_t num = 0;
+    uint32_t pos = 0;
+    while (pos < str.len)
+    {
+        if (num > 0 && (str.ptr[pos] == ':' || str.ptr[pos] == '-'))
+        {
+            pos++;
+        }
+        if (pos + 2 > str.len || num == 255)
+        {
+            return false;
+        }
+        const int hi = hex_digit(str.ptr[pos]);
+        const int lo = hex_digit(str.ptr[pos + 1]);
+        if (hi < 0 || lo < 0)
+        {
+            return false;
+        }
+        out[num++] = static_cast<uint8_t>((hi << 4) | lo);
+        pos += 2;
+    }
+    *len = num;
+    return num > 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t trie_insert(
+    TrieNode *trie,
+    uint32_t num_nodes,
+    const uint8_t *key,
+    uint32_t len,
+    uint8_t rule
+    )
+{
+    uint32_t node = 0;
+    for (uint32_t idx = 0; idx < len; idx++)
+    {
+        uint32_t child = trie[node].child;
+        while (child != 0 && trie[child].byte != key[idx])
+        {
+            child = trie[child].sibling;
+        }
+        if (child == 0)
+        {
+            child = num_nodes++;
+            trie[child].child = 0;
+            trie[child].sibling = trie[node].child;
+            trie[child].byte = key[idx];
+            trie[child].rule = NO_RULE;
+            trie[node].child = static_cast<uint16_t>(child);
+        }
+        node = child;
+    }
+    // an earlier rule with the same key takes precedence
+    if (trie[node].rule == NO_RULE)
+    {
+        trie[node].rule = rule;
+    }
+    return num_nodes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns the lowest rule along the path of 'key', i.e. the first rule whose
+// key is a prefix of 'key'.
+
+static uint8_t trie_match(
+    const TrieNode *trie,
+    const uint8_t *key,
+    uint32_t len
+    )
+{
+    uint8_t best = NO_RULE;
+    uint32_t node = 0;
+    for (uint32_t idx = 0; idx < len; idx++)
+    {
+        uint32_t child = trie[node].child;
+        while (child != 0 && trie[child].byte != key[idx])
+        {
+            child = trie[child].sibling;
+        }
+        if (child == 0)
+        {
+            break;
+        }
+        node = child;
+        if (trie[node].rule < best)
+        {
+            best = trie[node].rule;
+        }
+    }
+    return best;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void oui_insert(Policy *policy, uint32_t oui, uint8_t rule)
+{
+    uint32_t pos = policy->num_ouis;
+    while (pos > 0 && policy->ouis[pos - 1].oui > oui)
+    {
+        pos--;
+    }
+    if (pos > 0 && policy->ouis[pos - 1].oui == oui)
+    {
+        // an earlier rule with the same OUI takes precedence
+        return;
+    }
+    for (uint32_t idx = policy->num_ouis; idx > pos; idx--)
+    {
+        policy->ouis[idx] = policy->ouis[idx - 1];
+    }
+    policy->ouis[pos].oui = oui;
+    policy->ouis[pos].rule = rule;
+    policy->num_ouis++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint8_t oui_match(const Policy *policy, uint32_t oui)
+{
+    uint32_t lo = 0;
+    uint32_t hi = policy->num_ouis;
+    while (lo < hi)
+    {
+        const uint32_t mid = (lo + hi) / 2;
+        if (policy->ouis[mid].oui < oui)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    if (lo < policy->num_ouis && policy->ouis[lo].oui == oui)
+    {
+        return policy->ouis[lo].rule;
+    }
+    return NO_RULE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool parse_range(const IniStr& str, const Config *cfg, PolicyRule *rule)
+{
+    const char *dash = str.ptr;
+    while (dash < str.ptr + str.len && *dash != '-') dash++;
+    IniStr lo_str;
+    lo_str.ptr = str.ptr;
+    lo_str.len = static_cast<uint32_t>(dash - str.ptr);
+    IniStr hi_str;
+    hi_str.ptr = dash + 1;
+    hi_str.len = dash < str.ptr + str.len ? str.len - lo_str.len - 1 : 0;
+
+    uint32_t lo;
+    uint32_t hi;
+    if (!ini_parse_u32(lo_str, &lo) || !ini_parse_u32(hi_str, &hi))
+    {
+        return false;
+    }
+    const uint32_t start = cfg->range_start & ~CC_SUB_MASK_LE;
+    const uint32_t end = cfg->range_end & ~CC_SUB_MASK_LE;
+    if (lo > hi || lo < start || hi > end)
+    {
+        return false;
+    }
+    rule->first = static_cast<uint8_t>(lo - start);
+    rule->last = static_cast<uint8_t>(hi - start);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool compile_rule(
+    const IniEntry& entry,
+    const Config *cfg,
+    Policy *policy,
+    uint32_t *num_vendor,
+    uint32_t *num_client
+    )
+{
+    // the range follows the last blank, thus vendor texts may contain blanks
+    const IniStr& value = entry.value;
+    uint32_t split = value.len;
+    while (split > 0 && !is_blank(value.ptr[split - 1]))
+    {
+        split--;
+    }
+    if (split == 0)
+    {
+        return ini_error(entry.line, "missing range");
+    }
+    IniStr range;
+    range.ptr = value.ptr + split;
+    range.len = value.len - split;
+    IniStr match;
+    match.ptr = value.ptr;
+    match.len = split;
+    while (match.len > 0 && is_blank(match.ptr[match.len - 1]))
+    {
+        match.len--;
+    }
+
+    const uint8_t idx = static_cast<uint8_t>(policy->num_rules);
+    if (!parse_range(range, cfg, &policy->rules[idx]))
+    {
+        return ini_error(entry.line, "invalid range");
+    }
+
+    uint8_t bytes[255];
+    uint32_t len;
+    IniStr arg;
+    if (ini_starts_with(match, "vendor:"))
+    {
+        arg.ptr = match.ptr + 7;
+        arg.len = match.len - 7;
+        if (arg.len == 0 || arg.len > 255)
+        {
+            return ini_error(entry.line, "invalid vendor");
+        }
+        *num_vendor = trie_insert(
+            policy->vendor,
+            *num_vendor,
+            reinterpret_cast<const uint8_t*>(arg.ptr),
+            arg.len,
+            idx
+            );
+    }
+    else if (ini_starts_with(match, "client:"))
+    {
+        arg.ptr = match.ptr + 7;
+        arg.len = match.len - 7;
+        if (!parse_hex(arg, bytes, &len))
+        {
+            return ini_error(entry.line, "invalid client");
+        }
+        *num_client = trie_insert(policy->client, *num_client, bytes, len, idx);
+    }
+    else if (ini_starts_with(match, "oui:"))
+    {
+        arg.ptr = match.ptr + 4;
+        arg.len = match.len - 4;
+        if (!parse_hex(arg, bytes, &len) || len != 3)
+        {
+            return ini_error(entry.line, "invalid oui");
+        }
+        oui_insert(policy, (bytes[0] << 16) | (bytes[1] << 8) | bytes[2], idx);
+    }
+    else if (ini_equal(match, "any"))
+    {
+        if (policy->any == NO_RULE)
+        {
+            policy->any = idx;
+        }
+    }
+    else
+    {
+        return ini_error(entry.line, "invalid policy");
+    }
+    policy->num_rules++;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool policy_compile(const Ini *ini, const IniSection *sec, Config *cfg)
+{
+    // Size everything for the worst case, so that it fits into a single
+    // allocation: every rule is an OUI and every byte of a value becomes
+    // a node of a trie.
+    uint32_t num_rules = 0;
+    uint32_t max_nodes = 1;
+    for (uint32_t idx = 0; idx < sec->count; idx++)
+    {
+        const IniEntry &entry = ini->entries[sec->first + idx];
+        if (ini_equal(entry.key, "policy"))
+        {
+            if (++num_rules > MAX_RULES)
+            {
+                return ini_error(entry.line, "too many policies");
+            }
+            max_nodes += entry.value.len;
+        }
+    }
+    cfg->policy = nullptr;
+    if (num_rules == 0)
+    {
+        return true;
+    }
+
+    const size_t size = (
+        sizeof(Policy) +
+        num_rules * sizeof(OuiEntry) +
+        num_rules * sizeof(PolicyRule) +
+        2 * max_nodes * sizeof(TrieNode)
+        );
+    uint8_t *mem = static_cast<uint8_t*>(mem_alloc(size));
+    if (mem == nullptr)
+    {
+        return ini_error(sec->line, "out of memory");
+    }
+    Policy *policy = reinterpret_cast<Policy*>(mem);
+    mem += sizeof(Policy);
+    policy->ouis = reinterpret_cast<OuiEntry*>(mem);
+    mem += num_rules * sizeof(OuiEntry);
+    policy->rules = reinterpret_cast<PolicyRule*>(mem);
+    mem += num_rules * sizeof(PolicyRule);
+    policy->vendor = reinterpret_cast<TrieNode*>(mem);
+    mem += max_nodes * sizeof(TrieNode);
+    policy->client = reinterpret_cast<TrieNode*>(mem);
+    policy->vendor[0].rule = NO_RULE;
+    policy->client[0].rule = NO_RULE;
+    policy->any = NO_RULE;
+
+    uint32_t num_vendor = 1;
+    uint32_t num_client = 1;
+    for (uint32_t idx = 0; idx < sec->count; idx++)
+    {
+        const IniEntry &entry = ini->entries[sec->first + idx];
+        if (
+            ini_equal(entry.key, "policy") &&
+            !compile_rule(entry, cfg, policy, &num_vendor, &num_client)
+            )
+        {
+            mem_free(policy);
+            return false;
+        }
+    }
+    cfg->policy = policy;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void policy_select(
+    const Config *cfg,
+    const Request *req,
+    uint32_t *first,
+    uint32_t *last
+    )
+{
+    *first = 0;
+    *last = cfg->range_end - cfg->range_start;
+    const Policy *policy = cfg->policy;
+    if (policy == nullptr)
+    {
+        return;
+    }
+
+    const uint8_t *buf = reinterpret_cast<const uint8_t*>(req->buffer);
+    uint8_t best = policy->any;
+    if (req->vendor_class.offset)
+    {
+        const uint8_t rule = trie_match(
+            policy->vendor,
+            buf + req->vendor_class.offset,
+            req->vendor_class.len
+            );
+        best = rule < best ? rule : best;
+    }
+    if (req->client_id.offset)
+    {
+        const uint8_t rule = trie_match(
+            policy->client,
+            buf + req->client_id.offset,
+            req->client_id.len
+            );
+        best = rule < best ? rule : best;
+    }
+    if (policy->num_ouis)
+    {
+        const uint8_t *mac = reinterpret_cast<const uint8_t*>(
+            req->packet.chaddr
+            );
+        const uint8_t rule = oui_match(
+            policy,
+            (mac[0] << 16) | (mac[1] << 8) | mac[2]
+            );
+        best = rule < best ? rule : best;
+    }
+    if (best != NO_RULE)
+    {
+        *first = policy->rules[best].first;
+        *last = policy->rules[best].last;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
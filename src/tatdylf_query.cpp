@@ -0,0 +1,384 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2007-2025 Rocco Matano
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Local lease queries through a message mode named pipe. Every request
+// message is a batch of up to LQ_MAX_QUERIES LeaseQuery records, which is
+// answered by a single reply message of LeaseRecord records: one per MAC or
+// IP query and, for a dump, one per lease followed by a record with status
+// LQ_END.
+//
+// The lease tables are read through lease_snapshot, so a query never waits
+// for the lock of a pool and never delays the server. Every batch is
+// answered from the table that is current when it arrives.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tatdylf.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const uint32_t LQ_MAX_QUERIES = 64;
+
+enum LQ_OPS
+{
+    LQ_BY_MAC = 1,  // key: MAC
+    LQ_BY_IP  = 2,  // key: IP in network byte order, followed by two zeros
+    LQ_DUMP   = 3,  // key: ignored
+};
+
+enum LQ_STATUS
+{
+    LQ_FOUND     = 0,
+    LQ_NOT_FOUND = 1,
+    LQ_END       = 2,  // end of a dump
+    LQ_INVALID   = 3,  // unknown op
+};
+
+#pragma pack(push, 1)
+
+struct LeaseQuery
+{
+    uint8_t  op;
+    uint8_t  reserved;
+    uint8_t  key[6];
+};
+
+struct LeaseRecord
+{
+    uint8_t  status;
+    uint8_t  reserved;
+    uint8_t  mac[6];
+    uint32_t ip;         // network byte order
+    uint32_t remaining;  // seconds until the lease expires, 0 if it has
+};
+
+#pragma pack(pop)
+
+struct Reply
+{
+    LeaseRecord *records;
+    uint32_t    count;
+    uint32_t    capacity;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+static char pipe_path[MAX_PATH];
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Copies the clients of a pool without taking its lock. If a writer
+// interferes, the copy is simply taken again.
+
+void lease_snapshot(const Config *cfg, Client *clients)
+{
+    for (;;)
+    {
+        const uint32_t seq = cfg->seq;
+        _ReadWriteBarrier();
+        if (seq & 1)
+        {
+            YieldProcessor();
+            continue;
+        }
+        mem_cpy(clients, cfg->clients, cfg->capacity * sizeof(Client));
+        _ReadWriteBarrier();
+        if (cfg->seq == seq)
+        {
+            return;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static LeaseRecord* append(Reply *reply, uint8_t status)
+{
+    if (reply->count == reply->capacity)
+    {
+        const uint32_t new_cap = reply->capacity ? reply->capacity * 2 : 64;
+        void *records = mem_realloc(
+            reply->records,
+            new_cap * sizeof(LeaseRecord)
+            );
+        if (records == nullptr)
+        {
+            return nullptr;
+        }
+        reply->records = static_cast<LeaseRecord*>(records);
+        reply->capacity = new_cap;
+    }
+    LeaseRecord *rec = &reply->records[reply->count++];
+    zero_init(*rec);
+    rec->status = status;
+    return rec;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool append_lease(
+    Reply *reply,
+    const Config *pool,
+    const Client *clients,
+    uint32_t idx,
+    uint32_t now
+    )
+{
+    LeaseRecord *rec = append(reply, LQ_FOUND);
+    if (rec == nullptr)
+    {
+        return false;
+    }
+    mem_cpy(rec->mac, clients[idx].chaddr, sizeof(rec->mac));
+    rec->ip = htonl(pool->range_start + idx);
+    const uint32_t expiry = clients[idx].expiry;
+    rec->remaining = expiry > now ? expiry - now : 0;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline bool equal_key(const uint32_t *chaddr, const uint32_t *key)
+{
+    return chaddr[0] == key[0] && chaddr[1] == key[1];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// 'snap' holds the clients of all pools of 'tbl', one table after the other.
+
+static bool answer(
+    const LeaseQuery& query,
+    const ConfigTable *tbl,
+    const Client *snap,
+    uint32_t now,
+    Reply *reply
+    )
+{
+    uint32_t key[CHADDR_N32];
+    zero_init(key);
+    mem_cpy(key, query.key, sizeof(query.key));
+
+    const Client *next = snap;
+    for (uint32_t p = 0; p < tbl->num_pools; p++)
+    {
+        const Config *pool = &tbl->configs[p];
+        const Client *clients = next;
+        next += pool->capacity;
+        const uint32_t num = pool->range_end - pool->range_start + 1;
+        if (query.op == LQ_BY_IP)
+        {
+            const uint32_t ip = htonl(key[0]);
+            if (ip >= pool->range_start && ip <= pool->range_end)
+            {
+                const uint32_t idx = ip - pool->range_start;
+                if (clients[idx].chaddr[0] | clients[idx].chaddr[1])
+                {
+                    return append_lease(reply, pool, clients, idx, now);
+                }
+            }
+            continue;
+        }
+        for (uint32_t idx = 0; idx < num; idx++)
+        {
+            const Client &client = clients[idx];
+            if ((client.chaddr[0] | client.chaddr[1]) == 0)
+            {
+                continue;
+            }
+            if (query.op == LQ_DUMP)
+            {
+                if (!append_lease(reply, pool, clients, idx, now))
+                {
+                    return false;
+                }
+            }
+            else if (equal_key(client.chaddr, key))
+            {
+                return append_lease(reply, pool, clients, idx, now);
+            }
+        }
+    }
+    const uint8_t status = query.op == LQ_DUMP ? LQ_END : LQ_NOT_FOUND;
+    return append(reply, status) != nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static DWORD WINAPI serve_client(void *param)
+{
+    HANDLE pipe = param;
+    Client *snap = nullptr;
+    uint32_t snap_clients = 0;
+    Reply reply;
+    zero_init(reply);
+
+    LeaseQuery queries[LQ_MAX_QUERIES];
+    DWORD size;
+    while (
+        ReadFile(pipe, queries, sizeof(queries), &size, nullptr) &&
+        size % sizeof(LeaseQuery) == 0
+        )
+    {
+        const ConfigTable *tbl = config_table();
+        uint32_t num_clients = 0;
+        for (uint32_t p = 0; p < tbl->num_pools; p++)
+        {
+            num_clients += tbl->configs[p].capacity;
+        }
+        if (num_clients > snap_clients)
+        {
+            void *grown = mem_realloc(snap, num_clients * sizeof(Client));
+            if (grown == nullptr)
+            {
+                break;
+            }
+            snap = static_cast<Client*>(grown);
+            snap_clients = num_clients;
+        }
+        const uint32_t now = seconds_since_start();
+        Client *clients = snap;
+        for (uint32_t p = 0; p < tbl->num_pools; p++)
+        {
+            lease_snapshot(&tbl->configs[p], clients);
+            clients += tbl->configs[p].capacity;
+        }
+
+        reply.count = 0;
+        bool ok = true;
+        const uint32_t num_queries = size / sizeof(LeaseQuery);
+        for (uint32_t idx = 0; ok && idx < num_queries; idx++)
+        {
+            const LeaseQuery& query = queries[idx];
+            if (query.op < LQ_BY_MAC || query.op > LQ_DUMP)
+            {
+                ok = append(&reply, LQ_INVALID) != nullptr;
+            }
+            else
+            {
+                ok = answer(query, tbl, snap, now, &reply);
+            }
+        }
+
+        DWORD written;
+        if (
+            !ok ||
+            !WriteFile(
+                pipe,
+                reply.records,
+                reply.count * sizeof(LeaseRecord),
+                &written,
+                nullptr
+                )
+            )
+        {
+            break;
+        }
+    }
+
+    // Batches larger than LQ_MAX_QUERIES (ERROR_MORE_DATA) and malformed
+    // ones end the connection.
+    DisconnectNamedPipe(pipe);
+    CloseHandle(pipe);
+    mem_free(reply.records);
+    mem_free(snap);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static DWORD WINAPI run_query_server(void*)
+{
+    for (;;)
+    {
+        HANDLE pipe = CreateNamedPipe(
+            pipe_path,
+            PIPE_ACCESS_DUPLEX,
+            (
+                PIPE_TYPE_MESSAGE |
+                PIPE_READMODE_MESSAGE |
+                PIPE_WAIT |
+                PIPE_REJECT_REMOTE_CLIENTS
+            ),
+            PIPE_UNLIMITED_INSTANCES,
+            4096,
+            sizeof(LeaseQuery) * LQ_MAX_QUERIES,
+            0,
+            nullptr
+            );
+        if (pipe == INVALID_HANDLE_VALUE)
+        {
+            print_fmt("cannot create %s: %u\n", pipe_path, GetLastError());
+            return 1;
+        }
+        if (
+            ConnectNamedPipe(pipe, nullptr) ||
+            GetLastError() == ERROR_PIPE_CONNECTED
+            )
+        {
+            HANDLE thread = CreateThread(
+                nullptr,
+                0,
+                serve_client,
+                pipe,
+                0,
+                nullptr
+                );
+            if (thread != nullptr)
+            {
+                CloseHandle(thread);
+                continue;
+            }
+        }
+        CloseHandle(pipe);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool query_start(const char *pipe_name)
+{
+    sz_cpy(pipe_path, "\\\\.\\pipe\\");
+    sz_cpyn(
+        pipe_path + sz_len(pipe_path),
+        pipe_name,
+        MAX_PATH - sz_len(pipe_path)
+        );
+    HANDLE thread = CreateThread(
+        nullptr,
+        0,
+        run_query_server,
+        nullptr,
+        0,
+        nullptr
+        );
+    if (thread == nullptr)
+    {
+        return false;
+    }
+    CloseHandle(thread);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
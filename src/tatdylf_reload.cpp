@@ -0,0 +1,352 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2007-2025 Rocco Matano
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Live reload of the ini file. A thread waits for a change in the directory
+// of the ini file or for a request from the tray menu. It parses the file
+// into a new ConfigTable, while the serving threads carry on with the old
+// one. Then every Config of the old table is either replaced by the new one
+// for the same interface or relay agent, or it is removed. A replacement
+// takes over the socket and all leases whose address is still in its range.
+// This happens under the lock of the old Config, which is also the moment
+// it is retired. Threads that come across a retired Config move on to its
+// successor (see current_config), so they never wait for the reload
+// itself. Finally the new table is published as a whole.
+//
+// Retired Configs and tables are never freed: a thread that is blocked in
+// a receive may still refer to them, and threads only reach the current
+// Config through the chain of its predecessors. Each reload thus keeps the
+// previous table, about 16 KB per Config (mostly its LatencyStats) plus a
+// lease table of at most MAX_CLIENTS entries, 5 KB. Reloads are triggered
+// by hand, so this stays small unless the file is edited all the time.
+// Changes of [global] and [replication] take effect after a restart only.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tatdylf.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Editors write a file in several steps.
+static const DWORD SETTLE_MS = 500;
+
+static HANDLE reload_event = nullptr;
+static HANDLE dir_change = INVALID_HANDLE_VALUE;
+static char ini_file[MAX_PATH];
+
+////////////////////////////////////////////////////////////////////////////////
+
+void reload_request()
+{
+    if (reload_event != nullptr)
+    {
+        SetEvent(reload_event);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void discard(ConfigTable *tbl)
+{
+    free_pools(tbl->configs, tbl->num_pools);
+    mem_free(tbl->configs);
+    mem_free(tbl->relays);
+    mem_free(tbl);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Interfaces are matched by their address, relay pools by the one of their
+// relay agent.
+
+static Config* find_match(const ConfigTable *tbl, const Config *cfg)
+{
+    for (uint32_t idx = 0; idx < tbl->num_pools; idx++)
+    {
+        Config *prev = &tbl->configs[idx];
+        const bool same = (
+            cfg->server_ip ?
+            prev->server_ip == cfg->server_ip :
+            prev->relay_ip == cfg->relay_ip
+            );
+        if (same && !prev->retired)
+        {
+            return prev;
+        }
+    }
+    return nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void migrate(Config *prev, Config *cfg)
+{
+    AcquireSRWLockExclusive(&prev->lock);
+    cfg->socket = prev->socket;
+    cfg->rx_timestamps = prev->rx_timestamps;
+    cfg->wake = prev->wake;
+
+    // Samples of requests that are still processed with the old Config are
+    // not carried over.
+    mem_cpy(&cfg->stats, &prev->stats, sizeof(cfg->stats));
+    mem_cpy(&cfg->drops, &prev->drops, sizeof(cfg->drops));
+    mem_cpy(&cfg->pipe, &prev->pipe, sizeof(cfg->pipe));
+
+    const uint32_t num = prev->range_end - prev->range_start + 1;
+    for (uint32_t idx = 0; idx < num; idx++)
+    {
+        const Client &client = prev->clients[idx];
+        const uint32_t ip = prev->range_start + idx;
+        if (
+            (client.chaddr[0] | client.chaddr[1]) != 0 &&
+            ip >= cfg->range_start &&
+            ip <= cfg->range_end
+            )
+        {
+            cfg->clients[ip - cfg->range_start] = client;
+        }
+    }
+
+    Policy *policy = prev->policy;
+    prev->policy = nullptr;
+    prev->successor = cfg;
+    prev->retired = true;
+    ReleaseSRWLockExclusive(&prev->lock);
+    mem_free(policy);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Must be called with the hot-plug lock held. A loop that serves the socket
+// finds it invalid and stops using it: the single loop is woken to remove
+// it along with its event, registered I/O gets its receives back aborted.
+
+static void drop(Config *prev)
+{
+    AcquireSRWLockExclusive(&prev->lock);
+    Policy *policy = prev->policy;
+    prev->policy = nullptr;
+    prev->retired = true;
+    const HANDLE wake = prev->wake;
+    ReleaseSRWLockExclusive(&prev->lock);
+    mem_free(policy);
+
+    if (prev->server_ip == 0)
+    {
+        return;
+    }
+    if (!plug_remove(prev) && prev->socket != INVALID_SOCKET)
+    {
+        // served by a loop or by a thread that was started without hot-plug
+        const SOCKET sock = prev->socket;
+        prev->socket = INVALID_SOCKET;
+        closesocket(sock);
+        if (wake != nullptr)
+        {
+            SetEvent(wake);
+        }
+    }
+    in_addr inaddr;
+    inaddr.S_un.S_addr = prev->server_ip;
+    print_fmt("removed %s\n", inet_ntoa(inaddr));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void reload()
+{
+    Settings ignored;
+    zero_init(ignored);
+    ConfigTable *fresh = load_config(&ignored);
+    if (fresh == nullptr)
+    {
+        print_fmt("reload failed, keeping the current configuration\n");
+        return;
+    }
+    Config **added = static_cast<Config**>(
+        mem_alloc((fresh->num_ifaces + 1) * sizeof(Config*))
+        );
+    if (added == nullptr)
+    {
+        discard(fresh);
+        return;
+    }
+    sched_lock_table(fresh);
+    uint32_t num_added = 0;
+
+    plug_lock();
+    ConfigTable *prev_tbl = config_table();
+    for (uint32_t idx = 0; idx < fresh->num_pools; idx++)
+    {
+        Config *cfg = &fresh->configs[idx];
+        Config *prev = find_match(prev_tbl, cfg);
+        if (prev != nullptr)
+        {
+            migrate(prev, cfg);
+            if (idx < fresh->num_ifaces)
+            {
+                print_config(*cfg);
+            }
+        }
+        else if (idx < fresh->num_ifaces)
+        {
+            added[num_added++] = cfg;
+        }
+    }
+    publish_config(fresh);
+    for (uint32_t idx = 0; idx < prev_tbl->num_pools; idx++)
+    {
+        Config *prev = &prev_tbl->configs[idx];
+        if (!prev->retired)
+        {
+            drop(prev);
+        }
+    }
+    plug_unlock();
+    sched_unlock_table(prev_tbl);
+
+    // The wildcard socket serves new interfaces once it sees them. Without
+    // hot-plug, they can only be served if they can be bound right now.
+    if (wild_serving())
+    {
+        for (uint32_t idx = 0; idx < num_added; idx++)
+        {
+            print_config(*added[idx]);
+        }
+    }
+    else if (num_added > 0 && !plug_add(added, num_added))
+    {
+        for (uint32_t idx = 0; idx < num_added; idx++)
+        {
+            HANDLE thread = nullptr;
+            if (open_socket(added[idx]))
+            {
+                thread = CreateThread(
+                    nullptr,
+                    0,
+                    run_dhcp,
+                    added[idx],
+                    0,
+                    nullptr
+                    );
+            }
+            if (thread != nullptr)
+            {
+                CloseHandle(thread);
+            }
+        }
+    }
+    mem_free(added);
+    print_fmt("reloaded\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool write_time(FILETIME *time)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesEx(ini_file, GetFileExInfoStandard, &data))
+    {
+        return false;
+    }
+    *time = data.ftLastWriteTime;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static DWORD WINAPI run_reload(void*)
+{
+    HANDLE events[2] = { reload_event, dir_change };
+    const DWORD count = dir_change != INVALID_HANDLE_VALUE ? 2 : 1;
+    FILETIME last;
+    zero_init(last);
+    write_time(&last);
+
+    for (;;)
+    {
+        const DWORD res = WaitForMultipleObjects(
+            count,
+            events,
+            FALSE,
+            INFINITE
+            );
+        if (res == WAIT_OBJECT_0 + 1)
+        {
+            // Every file of the directory is reported, so we have to check
+            // whether it was the ini file that changed.
+            Sleep(SETTLE_MS);
+            FindNextChangeNotification(dir_change);
+            FILETIME now;
+            if (!write_time(&now) || CompareFileTime(&now, &last) == 0)
+            {
+                continue;
+            }
+            last = now;
+        }
+        else if (res != WAIT_OBJECT_0)
+        {
+            print_fmt("reload error %u\n", GetLastError());
+            return 1;
+        }
+        reload();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool reload_start(const char *ini_path)
+{
+    sz_cpyn(ini_file, ini_path, MAX_PATH);
+    char dir[MAX_PATH];
+    sz_cpy(dir, ini_file);
+    int len = sz_len(dir);
+    while (len && dir[len] != '\\') --len;
+    dir[len] = 0;
+
+    // Renaming is reported too, since some editors save that way.
+    dir_change = FindFirstChangeNotification(
+        dir,
+        FALSE,
+        FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME
+        );
+    if (dir_change == INVALID_HANDLE_VALUE)
+    {
+        print_fmt("ini file not watched, reload from the tray only\n");
+    }
+
+    reload_event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    if (reload_event == nullptr)
+    {
+        return false;
+    }
+    HANDLE thread = CreateThread(nullptr, 0, run_reload, nullptr, 0, nullptr);
+    if (thread == nullptr)
+    {
+        return false;
+    }
+    CloseHandle(thread);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
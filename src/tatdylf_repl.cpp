@@ -0,0 +1,726 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2007-2025 Rocco Matano
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Lease replication between an active and a standby instance. The active
+// instance streams every committed lease as a delta to the standby, which
+// acknowledges them cumulatively. Lost datagrams are recovered by sending
+// everything that has not been acknowledged again (go-back-N). When a
+// standby (re)appears, it asks for a full copy of the lease tables.
+//
+// Should the standby not hear from the active one for longer than the
+// configured takeover time, it opens the DHCP sockets and starts serving
+// with the replicated tables. From then on it acts as the active instance.
+// An instance configured as active that finds its peer serving already
+// starts as standby instead.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tatdylf.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const uint32_t REPL_MAGIC        = 0x4c504552; // "REPL"
+static const uint32_t REPL_MAX_BATCH    = 96;
+static const uint32_t REPL_MIN_RING     = 4096;
+static const DWORD    REPL_HEARTBEAT_MS = 250;
+static const DWORD    REPL_RETRANSMIT_MS = 100;
+
+enum REPL_TYPES
+{
+    REPL_DELTA = 1,  // active -> standby, 'count' deltas follow the header
+    REPL_ACK   = 2,  // standby -> active, 'seq' is the next expected seq
+};
+
+enum REPL_FLAGS
+{
+    REPL_FLAG_RESET = 1,  // DELTA: full copy starts at 'seq'
+    REPL_FLAG_SYNC  = 2,  // ACK: standby asks for a full copy
+};
+
+#pragma pack(push, 1)
+
+struct ReplHeader
+{
+    uint32_t magic;
+    uint8_t  type;
+    uint8_t  flags;
+    uint16_t count;
+    uint32_t seq;
+};
+
+struct ReplDelta
+{
+    uint32_t ip;         // network byte order
+    uint8_t  mac[6];
+    uint32_t remaining;  // seconds until the lease expires
+};
+
+#pragma pack(pop)
+
+struct ReplEntry
+{
+    uint32_t ip;
+    uint32_t chaddr[2];
+    uint32_t expiry;     // seconds_since_start
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+static Config *pools = nullptr;
+static uint32_t num_pools = 0;
+static SOCKET repl_socket = INVALID_SOCKET;
+static WSAEVENT sock_event = nullptr;
+static sockaddr_in peer;
+static DWORD takeover_ms = 0;
+static uint32_t loss_percent = 0;
+static uint32_t loss_state = 0;
+
+// Active side. Entries in [ring_first, next_seq) have not been acknowledged
+// yet, those in [ring_first, sent_seq) have been sent at least once.
+static SRWLOCK ring_lock;
+static HANDLE publish_event = nullptr;
+static ReplEntry *ring = nullptr;
+static uint32_t ring_size = 0;
+static uint32_t ring_first = 0;
+static uint32_t sent_seq = 0;
+static uint32_t next_seq = 0;
+static uint32_t reset_seq = 0;
+static bool need_resync = false;
+static volatile bool peer_alive = false;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool parse_endpoint(const IniStr& str, sockaddr_in *addr)
+{
+    IniStr ip = str;
+    IniStr port;
+    port.ptr = str.ptr;
+    port.len = 0;
+    for (uint32_t idx = 0; idx < str.len; idx++)
+    {
+        if (str.ptr[idx] == ':')
+        {
+            ip.len = idx;
+            port.ptr = str.ptr + idx + 1;
+            port.len = str.len - idx - 1;
+            break;
+        }
+    }
+    uint32_t port_num;
+    if (!ini_parse_u32(port, &port_num) || port_num == 0 || port_num > 65535)
+    {
+        return false;
+    }
+    uint32_t ip_num;
+    if (!ini_parse_ip(ip, &ip_num))
+    {
+        return false;
+    }
+    zero_init(*addr);
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(static_cast<USHORT>(port_num));
+    addr->sin_addr.s_addr = ip_num;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool repl_parse(const Ini *ini, const IniSection *sec, Settings *settings)
+{
+    settings->repl_takeover = 2000;
+    bool have_local = false;
+    bool have_peer = false;
+    for (uint32_t idx = 0; idx < sec->count; idx++)
+    {
+        const IniEntry &entry = ini->entries[sec->first + idx];
+        if (ini_equal(entry.key, "role"))
+        {
+            if (ini_equal(entry.value, "active"))
+            {
+                settings->repl_role = REPL_ACTIVE;
+            }
+            else if (ini_equal(entry.value, "standby"))
+            {
+                settings->repl_role = REPL_STANDBY;
+            }
+            else
+            {
+                return ini_error(entry.line, "invalid role");
+            }
+        }
+        else if (ini_equal(entry.key, "local"))
+        {
+            have_local = parse_endpoint(entry.value, &settings->repl_local);
+            if (!have_local)
+            {
+                return ini_error(entry.line, "invalid local");
+            }
+        }
+        else if (ini_equal(entry.key, "peer"))
+        {
+            have_peer = parse_endpoint(entry.value, &settings->repl_peer);
+            if (!have_peer)
+            {
+                return ini_error(entry.line, "invalid peer");
+            }
+        }
+        else if (ini_equal(entry.key, "takeover"))
+        {
+            if (
+                !ini_parse_u32(entry.value, &settings->repl_takeover) ||
+                settings->repl_takeover < 2 * REPL_HEARTBEAT_MS
+                )
+            {
+                return ini_error(entry.line, "invalid takeover");
+            }
+        }
+        else if (ini_equal(entry.key, "loss"))
+        {
+            if (
+                !ini_parse_u32(entry.value, &settings->repl_loss) ||
+                settings->repl_loss > 99
+                )
+            {
+                return ini_error(entry.line, "invalid loss");
+            }
+        }
+        else
+        {
+            return ini_error(entry.line, "unknown key");
+        }
+    }
+    if (settings->repl_role == REPL_NONE || !have_local || !have_peer)
+    {
+        return ini_error(sec->line, "role, local and peer are required");
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool repl_init(Config *cfg, uint32_t num_cfg, const Settings *settings)
+{
+    pools = cfg;
+    num_pools = num_cfg;
+    peer = settings->repl_peer;
+    takeover_ms = settings->repl_takeover;
+    loss_percent = settings->repl_loss;
+    loss_state = GetTickCount() | 1;
+
+    // A full copy of all tables has to fit into the ring.
+    uint32_t num_slots = 0;
+    for (uint32_t idx = 0; idx < num_pools; idx++)
+    {
+        num_slots += pools[idx].range_end - pools[idx].range_start + 1;
+    }
+    ring_size = num_slots * 2 > REPL_MIN_RING ? num_slots * 2 : REPL_MIN_RING;
+    ring = static_cast<ReplEntry*>(mem_alloc(ring_size * sizeof(ReplEntry)));
+    publish_event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    sock_event = WSACreateEvent();
+
+    repl_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (
+        ring == nullptr ||
+        repl_socket == INVALID_SOCKET ||
+        bind(
+            repl_socket,
+            reinterpret_cast<const sockaddr*>(&settings->repl_local),
+            sizeof(settings->repl_local)
+            ) == SOCKET_ERROR
+        )
+    {
+        print_fmt("replication error %d\n", WSAGetLastError());
+        return false;
+    }
+    WSAEventSelect(repl_socket, sock_event, FD_READ);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// With 'loss' a share of the datagrams in either direction is dropped
+// instead of being sent, so that the recovery of a pair on loopback can be
+// tested. xorshift32 is good enough to pick them.
+
+static void send_to_peer(const void *data, int size)
+{
+    if (loss_percent != 0)
+    {
+        loss_state ^= loss_state << 13;
+        loss_state ^= loss_state >> 17;
+        loss_state ^= loss_state << 5;
+        if (loss_state % 100 < loss_percent)
+        {
+            return;
+        }
+    }
+    sendto(
+        repl_socket,
+        static_cast<const char*>(data),
+        size,
+        0,
+        reinterpret_cast<const sockaddr*>(&peer),
+        sizeof(peer)
+        );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Receives the next datagram from the peer. Returns its size or 0 if there
+// is nothing (more) to read.
+
+static int receive_from_peer(char *buffer, int size)
+{
+    for (;;)
+    {
+        sockaddr_in from;
+        int from_len = sizeof(from);
+        int len = recvfrom(
+            repl_socket,
+            buffer,
+            size,
+            0,
+            reinterpret_cast<sockaddr*>(&from),
+            &from_len
+            );
+        if (len == SOCKET_ERROR)
+        {
+            // WSAECONNRESET merely tells us that the peer is not running
+            if (WSAGetLastError() == WSAECONNRESET)
+            {
+                continue;
+            }
+            return 0;
+        }
+        const ReplHeader *hdr = reinterpret_cast<const ReplHeader*>(buffer);
+        if (
+            from.sin_addr.s_addr == peer.sin_addr.s_addr &&
+            from.sin_port == peer.sin_port &&
+            len >= static_cast<int>(sizeof(ReplHeader)) &&
+            hdr->magic == REPL_MAGIC
+            )
+        {
+            return len;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// An instance configured as active must not serve while its peer does, as
+// after a takeover. It asks for a full copy like a standby would. An active
+// peer answers with deltas, a standby one with its own request.
+
+bool repl_peer_active()
+{
+    ReplHeader probe;
+    probe.magic = REPL_MAGIC;
+    probe.type = REPL_ACK;
+    probe.flags = REPL_FLAG_SYNC;
+    probe.count = 0;
+    probe.seq = 0;
+    send_to_peer(&probe, sizeof(probe));
+
+    // the heartbeats of an active peer arrive even if the probe got lost
+    const DWORD start = GetTickCount();
+    DWORD elapsed = 0;
+    while (elapsed < takeover_ms)
+    {
+        WaitForSingleObject(sock_event, takeover_ms - elapsed);
+        WSAResetEvent(sock_event);
+        char buffer[sizeof(ReplHeader) + REPL_MAX_BATCH * sizeof(ReplDelta)];
+        while (receive_from_peer(buffer, sizeof(buffer)) > 0)
+        {
+            const ReplHeader *hdr = reinterpret_cast<ReplHeader*>(buffer);
+            if (hdr->type == REPL_DELTA)
+            {
+                print_fmt("peer is active\n");
+                return true;
+            }
+            if (hdr->type == REPL_ACK)
+            {
+                return false;
+            }
+        }
+        elapsed = GetTickCount() - start;
+    }
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline bool seq_in(uint32_t seq, uint32_t first, uint32_t end)
+{
+    // first <= seq <= end, taking wrap around into account
+    return seq - first <= end - first;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void repl_publish(uint32_t ip, const uint32_t *chaddr, uint32_t expiry)
+{
+    if (!peer_alive)
+    {
+        return;
+    }
+    AcquireSRWLockExclusive(&ring_lock);
+    if (next_seq - ring_first >= ring_size)
+    {
+        // The standby is lagging too far behind. Instead of queuing ever
+        // more deltas, it will get a full copy.
+        need_resync = true;
+    }
+    else
+    {
+        ReplEntry &entry = ring[next_seq % ring_size];
+        entry.ip = ip;
+        entry.chaddr[0] = chaddr[0];
+        entry.chaddr[1] = chaddr[1];
+        entry.expiry = expiry;
+        next_seq++;
+    }
+    ReleaseSRWLockExclusive(&ring_lock);
+    SetEvent(publish_event);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void full_sync()
+{
+    // Must be called with ring_lock held. Pool locks are always taken after
+    // the ring lock, never the other way round.
+    ring_first = sent_seq = reset_seq = next_seq;
+    need_resync = false;
+    for (uint32_t idx = 0; idx < num_pools; idx++)
+    {
+        Config &pool = pools[idx];
+        const uint32_t num_addr = pool.range_end - pool.range_start + 1;
+        AcquireSRWLockShared(&pool.lock);
+        for (uint32_t slot = 0; slot < num_addr; slot++)
+        {
+            const Client &client = pool.clients[slot];
+            // expired entries go along, affinity probes past them
+            if (client.chaddr[0] | client.chaddr[1])
+            {
+                ReplEntry &entry = ring[next_seq++ % ring_size];
+                entry.ip = htonl(pool.range_start + slot);
+                entry.chaddr[0] = client.chaddr[0];
+                entry.chaddr[1] = client.chaddr[1];
+                entry.expiry = client.expiry;
+            }
+        }
+        ReleaseSRWLockShared(&pool.lock);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void send_deltas(bool heartbeat)
+{
+    // Must be called with ring_lock held.
+    char buffer[sizeof(ReplHeader) + REPL_MAX_BATCH * sizeof(ReplDelta)];
+    ReplHeader *hdr = reinterpret_cast<ReplHeader*>(buffer);
+    ReplDelta *deltas = reinterpret_cast<ReplDelta*>(hdr + 1);
+    const uint32_t now = seconds_since_start();
+
+    while (sent_seq != next_seq || heartbeat)
+    {
+        uint32_t count = next_seq - sent_seq;
+        if (count > REPL_MAX_BATCH)
+        {
+            count = REPL_MAX_BATCH;
+        }
+        hdr->magic = REPL_MAGIC;
+        hdr->type = REPL_DELTA;
+        hdr->flags = sent_seq == reset_seq ? REPL_FLAG_RESET : 0;
+        hdr->count = static_cast<uint16_t>(count);
+        hdr->seq = sent_seq;
+        for (uint32_t idx = 0; idx < count; idx++)
+        {
+            const ReplEntry &entry = ring[(sent_seq + idx) % ring_size];
+            deltas[idx].ip = entry.ip;
+            mem_cpy(deltas[idx].mac, entry.chaddr, sizeof(deltas[idx].mac));
+            deltas[idx].remaining = entry.expiry > now ? entry.expiry - now : 0;
+        }
+        send_to_peer(buffer, sizeof(ReplHeader) + count * sizeof(ReplDelta));
+        sent_seq += count;
+        heartbeat = false;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+DWORD WINAPI repl_run_active(void* not_used)
+{
+    static_cast<void>(not_used);
+    DWORD last_send = GetTickCount();
+    DWORD last_peer = last_send;
+    DWORD last_progress = last_send;
+    DWORD last_sync = last_send - REPL_HEARTBEAT_MS;
+
+    for (;;)
+    {
+        HANDLE handles[2] = { publish_event, sock_event };
+        WaitForMultipleObjects(2, handles, FALSE, REPL_RETRANSMIT_MS);
+        WSAResetEvent(sock_event);
+        const DWORD now = GetTickCount();
+
+        AcquireSRWLockExclusive(&ring_lock);
+
+        char buffer[sizeof(ReplHeader)];
+        while (receive_from_peer(buffer, sizeof(buffer)) > 0)
+        {
+            const ReplHeader *ack = reinterpret_cast<ReplHeader*>(buffer);
+            if (ack->type != REPL_ACK)
+            {
+                continue;
+            }
+            last_peer = now;
+            if (!peer_alive || (ack->flags & REPL_FLAG_SYNC))
+            {
+                // Requests that crossed the copy we are already sending
+                // must not restart it over and over again.
+                if (now - last_sync >= REPL_HEARTBEAT_MS)
+                {
+                    peer_alive = true;
+                    full_sync();
+                    last_sync = now;
+                }
+            }
+            else if (seq_in(ack->seq, ring_first, next_seq))
+            {
+                if (ack->seq != ring_first)
+                {
+                    last_progress = now;
+                }
+                ring_first = ack->seq;
+                if (!seq_in(sent_seq, ring_first, next_seq))
+                {
+                    sent_seq = ring_first;
+                }
+            }
+        }
+
+        if (peer_alive && now - last_peer > takeover_ms)
+        {
+            // Nobody is listening. Stop queuing until the standby is back.
+            print_fmt("standby lost\n");
+            peer_alive = false;
+            ring_first = sent_seq = next_seq;
+        }
+        if (need_resync)
+        {
+            full_sync();
+        }
+
+        // Should the oldest outstanding delta not have been acknowledged in
+        // time, we go back N.
+        if (ring_first == sent_seq)
+        {
+            last_progress = now;
+        }
+        else if (now - last_progress >= REPL_RETRANSMIT_MS)
+        {
+            sent_seq = ring_first;
+            last_progress = now;
+        }
+        const bool heartbeat = now - last_send >= REPL_HEARTBEAT_MS;
+        if (heartbeat || sent_seq != next_seq)
+        {
+            send_deltas(heartbeat);
+            last_send = now;
+        }
+
+        ReleaseSRWLockExclusive(&ring_lock);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static Config* find_pool(uint32_t ip)
+{
+    const uint32_t ip_host_end = htonl(ip);
+    for (uint32_t idx = 0; idx < num_pools; idx++)
+    {
+        if (
+            ip_host_end >= pools[idx].range_start &&
+            ip_host_end <= pools[idx].range_end
+            )
+        {
+            return &pools[idx];
+        }
+    }
+    return nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void apply_delta(const ReplDelta& delta, uint32_t now)
+{
+    Config *pool = find_pool(delta.ip);
+    if (pool == nullptr)
+    {
+        // configurations differ
+        return;
+    }
+    Client &client = pool->clients[htonl(delta.ip) - pool->range_start];
+    AcquireSRWLockExclusive(&pool->lock);
+    lease_write_begin(pool);
+    client.chaddr[0] = client.chaddr[1] = 0;
+    mem_cpy(client.chaddr, delta.mac, sizeof(delta.mac));
+    client.expiry = now + delta.remaining;
+    lease_write_end(pool);
+    ReleaseSRWLockExclusive(&pool->lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void clear_pools()
+{
+    for (uint32_t idx = 0; idx < num_pools; idx++)
+    {
+        AcquireSRWLockExclusive(&pools[idx].lock);
+        lease_write_begin(&pools[idx]);
+        mem_zero(pools[idx].clients, pools[idx].capacity * sizeof(Client));
+        lease_write_end(&pools[idx]);
+        ReleaseSRWLockExclusive(&pools[idx].lock);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The neighbor entries for the leases were added by the active instance. Now
+// that we serve them, we add those of the leases that are still running.
+// Cameras behind a relay agent are not our neighbors.
+
+static void add_neighbors()
+{
+    const uint32_t now = seconds_since_start();
+    for (uint32_t idx = 0; idx < num_pools; idx++)
+    {
+        Config &pool = pools[idx];
+        if (pool.server_ip == 0)
+        {
+            continue;
+        }
+        const uint32_t num_addr = pool.range_end - pool.range_start + 1;
+        AcquireSRWLockShared(&pool.lock);
+        for (uint32_t slot = 0; slot < num_addr; slot++)
+        {
+            const Client &client = pool.clients[slot];
+            if (client.expiry > now && (client.chaddr[0] | client.chaddr[1]))
+            {
+                neigh_add(
+                    htonl(pool.range_start + slot),
+                    client.chaddr,
+                    client.expiry
+                    );
+            }
+        }
+        ReleaseSRWLockShared(&pool.lock);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void repl_run_standby()
+{
+    print_fmt("waiting as standby\n");
+    bool have_base = false;
+    uint32_t expected = 0;
+    uint32_t last_reset = 0;
+    DWORD last_rx = GetTickCount();
+    DWORD last_ack = 0;
+
+    for (;;)
+    {
+        WaitForSingleObject(sock_event, REPL_HEARTBEAT_MS);
+        WSAResetEvent(sock_event);
+        const uint32_t secs = seconds_since_start();
+
+        // acknowledge once per burst of datagrams
+        bool received = false;
+        char buffer[sizeof(ReplHeader) + REPL_MAX_BATCH * sizeof(ReplDelta)];
+        int len;
+        while ((len = receive_from_peer(buffer, sizeof(buffer))) > 0)
+        {
+            const ReplHeader *hdr = reinterpret_cast<ReplHeader*>(buffer);
+            const uint32_t count = hdr->count;
+            const uint32_t msg_len = sizeof(*hdr) + count * sizeof(ReplDelta);
+            if (hdr->type != REPL_DELTA || len != static_cast<int>(msg_len))
+            {
+                continue;
+            }
+            received = true;
+            if (
+                (hdr->flags & REPL_FLAG_RESET) &&
+                (!have_base || hdr->seq != last_reset)
+                )
+            {
+                clear_pools();
+                have_base = true;
+                last_reset = expected = hdr->seq;
+            }
+            // Apply what is new. Deltas we already have are skipped, those
+            // behind a gap are dropped and will be sent again.
+            const uint32_t skip = expected - hdr->seq;
+            if (have_base && skip < count)
+            {
+                const ReplDelta *deltas = reinterpret_cast<const ReplDelta*>(
+                    hdr + 1
+                    );
+                for (uint32_t idx = skip; idx < count; idx++)
+                {
+                    apply_delta(deltas[idx], secs);
+                }
+                expected += count - skip;
+            }
+        }
+
+        const DWORD now = GetTickCount();
+        if (received)
+        {
+            last_rx = now;
+        }
+        else if (now - last_rx > takeover_ms)
+        {
+            print_fmt("taking over\n");
+            add_neighbors();
+            return;
+        }
+        if (received || now - last_ack >= REPL_HEARTBEAT_MS)
+        {
+            ReplHeader ack;
+            ack.magic = REPL_MAGIC;
+            ack.type = REPL_ACK;
+            ack.flags = have_base ? 0 : REPL_FLAG_SYNC;
+            ack.count = 0;
+            ack.seq = expected;
+            send_to_peer(&ack, sizeof(ack));
+            last_ack = now;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
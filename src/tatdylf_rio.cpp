@@ -0,0 +1,398 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2007-2025 Rocco Matano
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Serving requests through Registered I/O (Windows 8 and later). All sockets
+// share one completion queue and one registered buffer, that is split into
+// slots of one Request each. A slot always has exactly one operation
+// outstanding: either a receive or the send of the reply that was encoded in
+// place. Receives and sends are queued with RIO_MSG_DEFER and committed once
+// per batch of completions. As long as there are completions, serving
+// requests does not require any system call at all. Only when the queue has
+// run dry, we ask for a notification and wait for it.
+//
+// Unlike the Winsock path, this one does not collect kernel receive
+// timestamps.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tatdylf.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const uint32_t RIO_SLOTS = 32;  // per socket
+static const uint32_t RIO_BATCH = 64;  // completions dequeued at once
+
+// RIO expects the remote address to have the size of a SOCKADDR_INET.
+struct RioAddr
+{
+    sockaddr_in addr;
+    uint8_t     pad[28 - sizeof(sockaddr_in)];
+};
+
+struct RioSlot
+{
+    Request  req;
+    RioAddr  to;
+    uint32_t sock;     // index into RioLoop::socks
+    bool     sending;
+};
+
+struct RioSocket
+{
+    Config *cfg;
+    RIO_RQ rq;
+    bool   recv_deferred;
+    bool   send_deferred;
+};
+
+struct RioLoop
+{
+    RioSocket    *socks;
+    uint32_t     num_socks;
+    RioSlot      *slots;
+    uint32_t     num_slots;
+    RIO_BUFFERID buf_id;
+    RIO_CQ       cq;
+    HANDLE       event;
+};
+
+static RIO_EXTENSION_FUNCTION_TABLE rio;
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool rio_init()
+{
+    SOCKET sock = WSASocket(
+        AF_INET,
+        SOCK_DGRAM,
+        IPPROTO_UDP,
+        nullptr,
+        0,
+        WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO
+        );
+    if (sock == INVALID_SOCKET)
+    {
+        return false;
+    }
+    GUID guid = WSAID_MULTIPLE_RIO;
+    zero_init(rio);
+    rio.cbSize = sizeof(rio);
+    DWORD returned;
+    int err = WSAIoctl(
+        sock,
+        SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER,
+        &guid,
+        sizeof(guid),
+        &rio,
+        sizeof(rio),
+        &returned,
+        nullptr,
+        nullptr
+        );
+    closesocket(sock);
+    return err == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline ULONG buf_offset(const RioLoop *loop, const void *ptr)
+{
+    return static_cast<ULONG>(
+        static_cast<const char*>(ptr) - reinterpret_cast<char*>(loop->slots)
+        );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline PVOID slot_context(uint32_t idx)
+{
+    return reinterpret_cast<PVOID>(static_cast<uintptr_t>(idx));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void post_receive(RioLoop *loop, uint32_t idx)
+{
+    RioSlot &slot = loop->slots[idx];
+    RioSocket &sock = loop->socks[slot.sock];
+    zero_init(slot.req);
+    slot.sending = false;
+
+    RIO_BUF data;
+    data.BufferId = loop->buf_id;
+    data.Offset = buf_offset(loop, slot.req.buffer);
+    data.Length = sizeof(Packet);
+    if (!rio.RIOReceive(sock.rq, &data, 1, RIO_MSG_DEFER, slot_context(idx)))
+    {
+        print_fmt("rr error: %d\n", WSAGetLastError());
+        return;
+    }
+    sock.recv_deferred = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void post_send(RioLoop *loop, uint32_t idx, int size)
+{
+    RioSlot &slot = loop->slots[idx];
+    RioSocket &sock = loop->socks[slot.sock];
+    slot.sending = true;
+
+    RIO_BUF data;
+    data.BufferId = loop->buf_id;
+    data.Offset = buf_offset(loop, slot.req.buffer);
+    data.Length = static_cast<ULONG>(size);
+    RIO_BUF addr;
+    addr.BufferId = loop->buf_id;
+    addr.Offset = buf_offset(loop, &slot.to);
+    addr.Length = sizeof(slot.to);
+    if (!rio.RIOSendEx(
+        sock.rq,
+        &data,
+        1,
+        nullptr,
+        &addr,
+        nullptr,
+        nullptr,
+        RIO_MSG_DEFER,
+        slot_context(idx)
+        ))
+    {
+        print_fmt("sr error %d\n", WSAGetLastError());
+        post_receive(loop, idx);
+        return;
+    }
+    sock.send_deferred = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void complete(RioLoop *loop, const RIORESULT& res, uint64_t tsc)
+{
+    const uint32_t idx = static_cast<uint32_t>(res.RequestContext);
+    RioSlot &slot = loop->slots[idx];
+    Config *cfg = current_config(loop->socks[slot.sock].cfg);
+    Request *req = &slot.req;
+    if (const_cast<volatile SOCKET&>(cfg->socket) == INVALID_SOCKET)
+    {
+        // removed by a reload, which closed the socket: the slot stays idle
+        return;
+    }
+
+    if (slot.sending)
+    {
+        if (res.Status == 0)
+        {
+            req->tsc[MARK_SENT] = tsc;
+            record_latency(&cfg->stats, req);
+            if (commit_reply(req))
+            {
+                log_allotted(req);
+            }
+        }
+        else
+        {
+            print_fmt("sr error %d\n", res.Status);
+        }
+        post_receive(loop, idx);
+        return;
+    }
+
+    if (res.Status != 0)
+    {
+        print_fmt("rr error: %d\n", res.Status);
+        post_receive(loop, idx);
+        return;
+    }
+    req->tsc[MARK_RECEIVED] = tsc;
+    if (parse_request(req, static_cast<int>(res.BytesTransferred), cfg))
+    {
+        sockaddr_in to;
+        const int size = prepare_reply(req, cfg, &to);
+        if (size > 0)
+        {
+            zero_init(slot.to);
+            slot.to.addr = to;
+            post_send(loop, idx, size);
+            return;
+        }
+    }
+    post_receive(loop, idx);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void commit(RioLoop *loop)
+{
+    for (uint32_t idx = 0; idx < loop->num_socks; idx++)
+    {
+        RioSocket &sock = loop->socks[idx];
+        if (sock.send_deferred)
+        {
+            rio.RIOSend(sock.rq, nullptr, 0, RIO_MSG_COMMIT_ONLY, nullptr);
+            sock.send_deferred = false;
+        }
+        if (sock.recv_deferred)
+        {
+            rio.RIOReceive(sock.rq, nullptr, 0, RIO_MSG_COMMIT_ONLY, nullptr);
+            sock.recv_deferred = false;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool setup(RioLoop *loop, Config **cfg, uint32_t count)
+{
+    loop->num_socks = count;
+    loop->num_slots = count * RIO_SLOTS;
+    loop->socks = static_cast<RioSocket*>(
+        mem_alloc(count * sizeof(RioSocket))
+        );
+    loop->slots = static_cast<RioSlot*>(
+        mem_alloc(loop->num_slots * sizeof(RioSlot))
+        );
+    loop->event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    if (loop->socks == nullptr || loop->slots == nullptr || !loop->event)
+    {
+        return false;
+    }
+
+    loop->buf_id = rio.RIORegisterBuffer(
+        reinterpret_cast<PCHAR>(loop->slots),
+        loop->num_slots * sizeof(RioSlot)
+        );
+    if (loop->buf_id == RIO_INVALID_BUFFERID)
+    {
+        return false;
+    }
+
+    RIO_NOTIFICATION_COMPLETION notify;
+    zero_init(notify);
+    notify.Type = RIO_EVENT_COMPLETION;
+    notify.Event.EventHandle = loop->event;
+    notify.Event.NotifyReset = TRUE;
+    loop->cq = rio.RIOCreateCompletionQueue(loop->num_slots, &notify);
+    if (loop->cq == RIO_INVALID_CQ)
+    {
+        return false;
+    }
+
+    for (uint32_t idx = 0; idx < count; idx++)
+    {
+        RioSocket &sock = loop->socks[idx];
+        sock.cfg = cfg[idx];
+        sock.rq = rio.RIOCreateRequestQueue(
+            cfg[idx]->socket,
+            RIO_SLOTS,
+            1,
+            RIO_SLOTS,
+            1,
+            loop->cq,
+            loop->cq,
+            nullptr
+            );
+        if (sock.rq == RIO_INVALID_RQ)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void cleanup(RioLoop *loop)
+{
+    // Request queues cannot be closed without closing their sockets. As
+    // long as nothing was posted, the sockets still work with Winsock.
+    if (loop->cq != RIO_INVALID_CQ)
+    {
+        rio.RIOCloseCompletionQueue(loop->cq);
+    }
+    if (loop->buf_id != RIO_INVALID_BUFFERID && loop->buf_id != nullptr)
+    {
+        rio.RIODeregisterBuffer(loop->buf_id);
+    }
+    if (loop->event)
+    {
+        CloseHandle(loop->event);
+    }
+    mem_free(loop->slots);
+    mem_free(loop->socks);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns only if the queues could not be set up.
+
+void rio_run(Config **cfg, uint32_t count)
+{
+    RioLoop loop;
+    zero_init(loop);
+    if (!setup(&loop, cfg, count))
+    {
+        print_fmt("RIO setup failed: %d\n", WSAGetLastError());
+        cleanup(&loop);
+        return;
+    }
+
+    for (uint32_t idx = 0; idx < count; idx++)
+    {
+        print_config(*cfg[idx]);
+    }
+    for (uint32_t idx = 0; idx < loop.num_slots; idx++)
+    {
+        loop.slots[idx].sock = idx / RIO_SLOTS;
+        post_receive(&loop, idx);
+    }
+    commit(&loop);
+
+    RIORESULT results[RIO_BATCH];
+    for (;;)
+    {
+        const ULONG num = rio.RIODequeueCompletion(loop.cq, results, RIO_BATCH);
+        if (num == 0)
+        {
+            // The event is signaled right away if completions arrived in
+            // the meantime.
+            rio.RIONotify(loop.cq);
+            WaitForSingleObject(loop.event, INFINITE);
+            continue;
+        }
+        if (num == RIO_CORRUPT_CQ)
+        {
+            print_fmt("RIO completion queue corrupt\n");
+            ExitProcess(1);
+        }
+        const uint64_t tsc = __rdtsc();
+        for (ULONG idx = 0; idx < num; idx++)
+        {
+            complete(&loop, results[idx], tsc);
+        }
+        commit(&loop);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
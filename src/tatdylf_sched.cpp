@@ -0,0 +1,226 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2007-2025 Rocco Matano
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Keeping the serving threads responsive on hosts that are busy otherwise.
+// An interface can have its thread pinned to a CPU and run at a priority of
+// the real-time class, which puts it ahead of everything that runs with
+// normal priority. Pages that are used while serving can be locked into the
+// working set, so that a reply never waits for a page to be read back.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tatdylf.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool lock_enabled = false;
+static SRWLOCK lock = SRWLOCK_INIT;  // serializes changes of the working set
+
+////////////////////////////////////////////////////////////////////////////////
+
+void sched_init(bool lock_memory)
+{
+    lock_enabled = lock_memory;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Windows knows no fixed priorities like SCHED_FIFO, but within the
+// real-time class a thread priority selects one of the base priorities
+// 16 to 31, that are not boosted or decayed. Every other thread of the
+// process, including those of the system thread pool, runs at the normal
+// one of 24, so only 25 to 31 put a serving thread ahead of them. The high
+// class, which Windows may give us instead, knows only the thread
+// priorities up to THREAD_PRIORITY_HIGHEST besides time critical.
+
+static int thread_priority(uint32_t base, bool realtime)
+{
+    if (base == PRIORITY_MAX)
+    {
+        return THREAD_PRIORITY_TIME_CRITICAL;
+    }
+    const int priority = static_cast<int>(base) - 24;
+    if (!realtime && priority > THREAD_PRIORITY_HIGHEST)
+    {
+        return THREAD_PRIORITY_HIGHEST;
+    }
+    return priority;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Pins the calling thread to 'cpu' and gives it 'priority'. CPU_ANY and 0
+// restore the defaults.
+
+void sched_set(uint32_t cpu, uint32_t priority)
+{
+    HANDLE thread = GetCurrentThread();
+
+    DWORD_PTR mask;
+    DWORD_PTR sys_mask;
+    GetProcessAffinityMask(GetCurrentProcess(), &mask, &sys_mask);
+    if (cpu != CPU_ANY)
+    {
+        mask = static_cast<DWORD_PTR>(1) << cpu;
+    }
+    if (SetThreadAffinityMask(thread, mask) == 0)
+    {
+        print_fmt("cannot pin to CPU %u: %u\n", cpu, GetLastError());
+    }
+
+    int thread_prio = THREAD_PRIORITY_NORMAL;
+    if (priority != 0)
+    {
+        // Without SeIncreaseBasePriorityPrivilege Windows silently makes
+        // this the high priority class.
+        HANDLE process = GetCurrentProcess();
+        bool realtime = GetPriorityClass(process) == REALTIME_PRIORITY_CLASS;
+        if (!realtime)
+        {
+            SetPriorityClass(process, REALTIME_PRIORITY_CLASS);
+            realtime = GetPriorityClass(process) == REALTIME_PRIORITY_CLASS;
+            if (!realtime)
+            {
+                print_fmt("no real-time priority class\n");
+            }
+        }
+        thread_prio = thread_priority(priority, realtime);
+    }
+    if (!SetThreadPriority(thread, thread_prio))
+    {
+        print_fmt("cannot set priority: %u\n", GetLastError());
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Applies the settings of 'cfg' to the calling thread. After a reload the
+// thread gets the new ones, including the defaults if they were removed.
+
+void sched_apply(const Config *cfg)
+{
+    sched_set(cfg->cpu, cfg->priority);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Locks the pages of [ptr, ptr + size) into the working set, which also
+// faults them in. The working set is grown by the same amount, since
+// VirtualLock fails once the locked pages would exceed its minimum.
+
+void sched_lock(const void *ptr, size_t size)
+{
+    if (!lock_enabled || size == 0)
+    {
+        return;
+    }
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    const size_t grow = size + 2 * si.dwPageSize;
+
+    AcquireSRWLockExclusive(&lock);
+    HANDLE process = GetCurrentProcess();
+    SIZE_T min_size;
+    SIZE_T max_size;
+    if (
+        !GetProcessWorkingSetSize(process, &min_size, &max_size) ||
+        !SetProcessWorkingSetSize(process, min_size + grow, max_size + grow) ||
+        !VirtualLock(const_cast<void*>(ptr), size)
+        )
+    {
+        print_fmt("cannot lock memory: %u\n", GetLastError());
+    }
+    ReleaseSRWLockExclusive(&lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void sched_lock_table(const ConfigTable *tbl)
+{
+    sched_lock(tbl->configs, tbl->num_pools * sizeof(Config));
+    for (uint32_t idx = 0; idx < tbl->num_pools; idx++)
+    {
+        const Config &cfg = tbl->configs[idx];
+        sched_lock(cfg.clients, cfg.capacity * sizeof(Client));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Undoes sched_lock for the pages that lie completely within [ptr, ptr +
+// size) and shrinks the working set by as much. VirtualLock does not count,
+// so the pages at either end, which may belong to other locked memory as
+// well, stay locked.
+
+void sched_unlock(const void *ptr, size_t size)
+{
+    if (!lock_enabled || size == 0)
+    {
+        return;
+    }
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    const uintptr_t page_mask = si.dwPageSize - 1;
+    const uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
+    const uintptr_t first = (start + page_mask) & ~page_mask;
+    const uintptr_t end = (start + size) & ~page_mask;
+    if (end <= first)
+    {
+        return;
+    }
+    const size_t shrink = end - first;
+
+    AcquireSRWLockExclusive(&lock);
+    HANDLE process = GetCurrentProcess();
+    SIZE_T min_size;
+    SIZE_T max_size;
+    VirtualUnlock(reinterpret_cast<void*>(first), shrink);
+    if (
+        GetProcessWorkingSetSize(process, &min_size, &max_size) &&
+        min_size > shrink
+        )
+    {
+        SetProcessWorkingSetSize(process, min_size - shrink, max_size - shrink);
+    }
+    ReleaseSRWLockExclusive(&lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Threads that started out with a Config of a retired table still go through
+// its 'successor' (see current_config), so the head of every Config stays
+// locked. Its statistics and its lease table are not used anymore.
+
+void sched_unlock_table(const ConfigTable *tbl)
+{
+    for (uint32_t idx = 0; idx < tbl->num_pools; idx++)
+    {
+        const Config &cfg = tbl->configs[idx];
+        const uint8_t *tail = reinterpret_cast<const uint8_t*>(&cfg.stats);
+        sched_unlock(tail, reinterpret_cast<const uint8_t*>(&cfg + 1) - tail);
+        sched_unlock(cfg.clients, cfg.capacity * sizeof(Client));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,356 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2007-2025 Rocco Matano
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tatdylf.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t base_tsc;
+static uint64_t base_qpc;
+
+static const char* const STAGE_NAMES[NUM_STAGES] =
+{
+    "receive",
+    "parse",
+    "assign",
+    "encode",
+    "send",
+    "total",
+};
+
+static const char* const RING_NAMES[NUM_RINGS] =
+{
+    "free",
+    "rx",
+    "tx",
+};
+
+static const char* const DROP_NAMES[NUM_DROPS] =
+{
+    "short",
+    "not request",
+    "not ethernet",
+    "no cookie",
+    "malformed",
+    "msg type",
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint64_t read_qpc()
+{
+    LARGE_INTEGER li;
+    QueryPerformanceCounter(&li);
+    return static_cast<uint64_t>(li.QuadPart);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void stats_init()
+{
+    // The TSC frequency is determined lazily when the statistics are dumped
+    // by relating the elapsed TSC cycles to the elapsed QPC ticks. That way
+    // we neither have to wait for a calibration at startup nor do we depend
+    // on a frequency the OS might not tell us.
+    base_tsc = __rdtsc();
+    base_qpc = read_qpc();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t bucket_index(uint64_t value)
+{
+    if (value < HIST_SUB_COUNT)
+    {
+        return static_cast<uint32_t>(value);
+    }
+
+    unsigned long msb;
+    const uint32_t hi = static_cast<uint32_t>(value >> 32);
+    if (hi)
+    {
+        _BitScanReverse(&msb, hi);
+        msb += 32;
+    }
+    else
+    {
+        _BitScanReverse(&msb, static_cast<uint32_t>(value));
+    }
+    if (msb >= HIST_MAX_BITS)
+    {
+        return HIST_BUCKETS - 1;
+    }
+
+    const uint32_t shift = msb - HIST_SUB_BITS;
+    const uint32_t sub = static_cast<uint32_t>(value >> shift);
+    return (shift + 1) * HIST_SUB_COUNT + (sub & (HIST_SUB_COUNT - 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t bucket_value(uint32_t idx)
+{
+    // highest value that is counted in bucket 'idx'
+    if (idx < HIST_SUB_COUNT)
+    {
+        return idx;
+    }
+    const uint32_t shift = idx / HIST_SUB_COUNT - 1;
+    const uint64_t sub = HIST_SUB_COUNT + idx % HIST_SUB_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void hist_record(Histogram *hist, uint64_t start, uint64_t end)
+{
+    // The TSCs of different cores may differ slightly. Should we have been
+    // moved to another core in between, we might see time running backwards.
+    hist->counts[bucket_index(end > start ? end - start : 0)]++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void record_latency(LatencyStats *stats, const Request *req)
+{
+    if (req->rx_qpc)
+    {
+        hist_record(&stats->stages[STAGE_RECEIVE], req->rx_qpc, req->user_qpc);
+    }
+
+    // Stage N lasts from mark N - 1 to mark N.
+    for (uint32_t stage = STAGE_PARSE; stage < STAGE_TOTAL; stage++)
+    {
+        hist_record(
+            &stats->stages[stage],
+            req->tsc[stage - 1],
+            req->tsc[stage]
+            );
+    }
+    hist_record(
+        &stats->stages[STAGE_TOTAL],
+        req->tsc[MARK_RECEIVED],
+        req->tsc[MARK_SENT]
+        );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint64_t mul_div(uint64_t value, uint64_t mul, uint64_t div)
+{
+    // value * mul / div without overflowing the intermediate product
+    return (value / div) * mul + (value % div) * mul / div;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t to_ns(uint64_t value, uint64_t mul, uint64_t div)
+{
+    const uint64_t ns = mul_div(value, mul, div);
+    return ns > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(ns);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void dump_latency(const LatencyStats *stats, uint32_t server_ip)
+{
+    static const uint32_t PERMILLE[] = { 500, 900, 990, 999 };
+    static const uint32_t NUM_PERMILLE = ARRAYSIZE(PERMILLE);
+
+    LARGE_INTEGER qpf;
+    QueryPerformanceFrequency(&qpf);
+    const uint64_t qpc_freq = static_cast<uint64_t>(qpf.QuadPart);
+    const uint64_t elapsed_us = mul_div(
+        read_qpc() - base_qpc,
+        1000000,
+        qpc_freq
+        );
+    uint64_t cycles_per_us = (__rdtsc() - base_tsc) / (elapsed_us + 1);
+    if (cycles_per_us == 0)
+    {
+        cycles_per_us = 1;
+    }
+
+    in_addr inaddr;
+    inaddr.S_un.S_addr = server_ip;
+    print_fmt("\nLatency [ns] on %s\n", inet_ntoa(inaddr));
+    print_fmt(
+        "%-8s %9s %9s %9s %9s %9s %9s\n",
+        "stage",
+        "count",
+        "p50",
+        "p90",
+        "p99",
+        "p99.9",
+        "max"
+        );
+
+    for (uint32_t stage = 0; stage < NUM_STAGES; stage++)
+    {
+        // take a snapshot, so that all percentiles refer to the same data
+        uint32_t counts[HIST_BUCKETS];
+        uint64_t total = 0;
+        uint32_t last = 0;
+        for (uint32_t idx = 0; idx < HIST_BUCKETS; idx++)
+        {
+            counts[idx] = stats->stages[stage].counts[idx];
+            total += counts[idx];
+            if (counts[idx])
+            {
+                last = idx;
+            }
+        }
+
+        print_fmt("%-8s %9u", STAGE_NAMES[stage], static_cast<uint32_t>(total));
+        if (total == 0)
+        {
+            print_fmt("\n");
+            continue;
+        }
+
+        const uint64_t mul = stage == STAGE_RECEIVE ? 1000000000 : 1000;
+        const uint64_t div = stage == STAGE_RECEIVE ? qpc_freq : cycles_per_us;
+        uint64_t seen = 0;
+        uint32_t idx = 0;
+        for (uint32_t p = 0; p < NUM_PERMILLE; p++)
+        {
+            const uint64_t rank = (total * PERMILLE[p] + 999) / 1000;
+            while (seen + counts[idx] < rank)
+            {
+                seen += counts[idx++];
+            }
+            print_fmt(" %9u", to_ns(bucket_value(idx), mul, div));
+        }
+        print_fmt(" %9u\n", to_ns(bucket_value(last), mul, div));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void dump_drops(const DropStats *drops)
+{
+    print_fmt("\nDropped\n");
+    for (uint32_t reason = 0; reason < NUM_DROPS; reason++)
+    {
+        print_fmt("%-12s %9u\n", DROP_NAMES[reason], drops->counts[reason]);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Prints nothing unless the interface is served by a pipeline.
+
+void dump_pipe(const PipeStats *pipe)
+{
+    static const uint32_t PERCENT[] = { 50, 90, 99 };
+    static const uint32_t NUM_PERCENT = ARRAYSIZE(PERCENT);
+
+    bool header = false;
+    for (uint32_t ring = 0; ring < NUM_RINGS; ring++)
+    {
+        uint32_t counts[PIPE_SLOTS + 1];
+        uint64_t total = 0;
+        uint32_t last = 0;
+        for (uint32_t idx = 0; idx <= PIPE_SLOTS; idx++)
+        {
+            counts[idx] = pipe->counts[ring][idx];
+            total += counts[idx];
+            if (counts[idx])
+            {
+                last = idx;
+            }
+        }
+        if (total == 0)
+        {
+            continue;
+        }
+        if (!header)
+        {
+            print_fmt("\nRing occupancy\n");
+            print_fmt(
+                "%-8s %9s %9s %9s %9s %9s\n",
+                "ring",
+                "count",
+                "p50",
+                "p90",
+                "p99",
+                "max"
+                );
+            header = true;
+        }
+
+        print_fmt("%-8s %9u", RING_NAMES[ring], static_cast<uint32_t>(total));
+        uint64_t seen = 0;
+        uint32_t idx = 0;
+        for (uint32_t p = 0; p < NUM_PERCENT; p++)
+        {
+            const uint64_t rank = (total * PERCENT[p] + 99) / 100;
+            while (seen + counts[idx] < rank)
+            {
+                seen += counts[idx++];
+            }
+            print_fmt(" %9u", idx);
+        }
+        print_fmt(" %9u\n", last);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Dumps the statistics every 'interval' seconds, in addition to the tray
+// item, so that they are recorded when the console is redirected to a file.
+
+static DWORD WINAPI run_periodic(void *param)
+{
+    const DWORD interval_ms = static_cast<DWORD>(
+        reinterpret_cast<uintptr_t>(param) * 1000
+        );
+    for (;;)
+    {
+        Sleep(interval_ms);
+        dump_stats();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool stats_start(uint32_t interval)
+{
+    HANDLE thread = CreateThread(
+        nullptr,
+        0,
+        run_periodic,
+        reinterpret_cast<void*>(static_cast<uintptr_t>(interval)),
+        0,
+        nullptr
+        );
+    if (thread == nullptr)
+    {
+        return false;
+    }
+    CloseHandle(thread);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
@@ -52,8 +52,12 @@ static LRESULT CALLBACK wnd_proc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp)
 {
     static const int IDM_EXIT = 1;
     static const int IDM_DETACH = 2;
+    static const int IDM_STATS = 3;
+    static const int IDM_RELOAD = 4;
     static const char EXIT_MSG[] = "Terminate";
     static const char DETACH_MSG[] = "Detatch";
+    static const char STATS_MSG[] = "Statistics";
+    static const char RELOAD_MSG[] = "Reload";
 
     notify_data.hWnd = hwnd;
     switch (msg)
@@ -63,6 +67,8 @@ static LRESULT CALLBACK wnd_proc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp)
             popup_menu = CreatePopupMenu();
             AppendMenu(popup_menu, 0, IDM_EXIT, EXIT_MSG);
             AppendMenu(popup_menu, 0, IDM_DETACH, DETACH_MSG);
+            AppendMenu(popup_menu, 0, IDM_STATS, STATS_MSG);
+            AppendMenu(popup_menu, 0, IDM_RELOAD, RELOAD_MSG);
 
             ShowWindow(console_wnd, SW_HIDE);
             next_state = SW_RESTORE;
@@ -111,6 +117,14 @@ static LRESULT CALLBACK wnd_proc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp)
                     DestroyWindow(hwnd);
                     return 0;
 
+                case IDM_STATS:
+                    dump_stats();
+                    return 0;
+
+                case IDM_RELOAD:
+                    reload_request();
+                    return 0;
+
                 case IDM_EXIT:
                     Shell_NotifyIcon(NIM_DELETE, &notify_data);
                     ExitProcess(0);
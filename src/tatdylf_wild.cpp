@@ -0,0 +1,335 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2007-2025 Rocco Matano
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Serving all interfaces through a single socket that is bound to
+// INADDR_ANY. With IP_PKTINFO every datagram comes with the index of the
+// interface it arrived on, which leads to the Config of that interface
+// through a table indexed by the interface index. The reply is sent with an
+// IN_PKTINFO of its own, that names the interface and the address of the
+// server as the source, so it leaves through the interface the request came
+// in on.
+//
+// The table is built from the unicast addresses of the host. It is rebuilt
+// whenever a reload has replaced the configuration and, at most once per
+// second, when a datagram arrives on an interface that it does not know.
+// Thus interfaces that come up later need neither a socket nor a thread of
+// their own.
+//
+// Kernel receive timestamps are not collected in this mode.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tatdylf.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct IfaceMap
+{
+    Config            **by_index;  // nullptr for unknown interfaces
+    uint32_t          size;
+    const ConfigTable *tbl;        // the table the map was built from
+    uint32_t          built;       // seconds_since_start
+};
+
+static SOCKET sock = INVALID_SOCKET;
+static LPFN_WSARECVMSG wsa_recv_msg = nullptr;
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool wild_serving()
+{
+    return sock != INVALID_SOCKET;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool wild_open(LPFN_WSARECVMSG recv_msg)
+{
+    if (recv_msg == nullptr)
+    {
+        return false;
+    }
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s == INVALID_SOCKET)
+    {
+        return false;
+    }
+    BOOL opt_val = true;
+    sockaddr_in addr;
+    zero_init(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(SERVER_PORT);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (
+        setsockopt(
+            s,
+            SOL_SOCKET,
+            SO_BROADCAST,
+            reinterpret_cast<char*>(&opt_val),
+            sizeof(opt_val)
+            ) == SOCKET_ERROR ||
+        setsockopt(
+            s,
+            IPPROTO_IP,
+            IP_PKTINFO,
+            reinterpret_cast<char*>(&opt_val),
+            sizeof(opt_val)
+            ) == SOCKET_ERROR ||
+        bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+        )
+    {
+        print_fmt("failed to bind wildcard socket: %d\n", WSAGetLastError());
+        closesocket(s);
+        return false;
+    }
+    wsa_recv_msg = recv_msg;
+    sock = s;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void build_map(IfaceMap *map)
+{
+    const ConfigTable *tbl = config_table();
+    map->tbl = tbl;
+    map->built = seconds_since_start();
+    if (map->by_index != nullptr)
+    {
+        mem_zero(map->by_index, map->size * sizeof(Config*));
+    }
+
+    PMIB_UNICASTIPADDRESS_TABLE addrs;
+    if (GetUnicastIpAddressTable(AF_INET, &addrs) != NO_ERROR)
+    {
+        return;
+    }
+    for (ULONG row = 0; row < addrs->NumEntries; row++)
+    {
+        const MIB_UNICASTIPADDRESS_ROW &entry = addrs->Table[row];
+        const uint32_t ip = entry.Address.Ipv4.sin_addr.s_addr;
+        const NET_IFINDEX ifindex = entry.InterfaceIndex;
+        for (uint32_t idx = 0; idx < tbl->num_ifaces; idx++)
+        {
+            if (tbl->configs[idx].server_ip != ip)
+            {
+                continue;
+            }
+            if (ifindex >= map->size)
+            {
+                const uint32_t new_size = ifindex + 16;
+                void *grown = mem_realloc(
+                    map->by_index,
+                    new_size * sizeof(Config*)
+                    );
+                if (grown == nullptr)
+                {
+                    break;
+                }
+                map->by_index = static_cast<Config**>(grown);
+                mem_zero(
+                    &map->by_index[map->size],
+                    (new_size - map->size) * sizeof(Config*)
+                    );
+                map->size = new_size;
+            }
+            map->by_index[ifindex] = &tbl->configs[idx];
+            break;
+        }
+    }
+    FreeMibTable(addrs);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static Config* lookup(IfaceMap *map, NET_IFINDEX ifindex)
+{
+    if (map->tbl != config_table())
+    {
+        build_map(map);
+    }
+    for (uint32_t attempt = 0; attempt < 2; attempt++)
+    {
+        if (ifindex < map->size && map->by_index[ifindex] != nullptr)
+        {
+            return current_config(map->by_index[ifindex]);
+        }
+        if (attempt > 0 || map->built == seconds_since_start())
+        {
+            break;
+        }
+        // the interface may have got its address since
+        build_map(map);
+    }
+    return nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns the size of the datagram or SOCKET_ERROR. 'ifindex' is left
+// untouched if there is no IN_PKTINFO.
+
+static int receive(Request *req, NET_IFINDEX *ifindex)
+{
+    zero_init(*req);
+
+    WSABUF buf;
+    buf.buf = req->buffer;
+    buf.len = sizeof(Packet);
+
+    uint64_t control[8];
+    WSAMSG msg;
+    zero_init(msg);
+    msg.lpBuffers = &buf;
+    msg.dwBufferCount = 1;
+    msg.Control.buf = reinterpret_cast<char*>(control);
+    msg.Control.len = sizeof(control);
+
+    DWORD size;
+    if (wsa_recv_msg(sock, &msg, &size, nullptr, nullptr) != 0)
+    {
+        print_fmt("rr error: %d\n", WSAGetLastError());
+        return SOCKET_ERROR;
+    }
+    req->tsc[MARK_RECEIVED] = __rdtsc();
+
+    WSACMSGHDR *cmsg = WSA_CMSG_FIRSTHDR(&msg);
+    for (; cmsg != nullptr; cmsg = WSA_CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
+        {
+            IN_PKTINFO info;
+            mem_cpy(&info, WSA_CMSG_DATA(cmsg), sizeof(info));
+            *ifindex = info.ipi_ifindex;
+        }
+    }
+    return static_cast<int>(size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns true if a lease was committed.
+
+static bool transmit(
+    Request *req,
+    Config *cfg,
+    NET_IFINDEX ifindex,
+    sockaddr_in to,
+    int size
+    )
+{
+    WSABUF buf;
+    buf.buf = req->buffer;
+    buf.len = static_cast<ULONG>(size);
+
+    uint64_t control[8];
+    WSAMSG msg;
+    zero_init(msg);
+    zero_init(control);
+    msg.name = reinterpret_cast<sockaddr*>(&to);
+    msg.namelen = sizeof(to);
+    msg.lpBuffers = &buf;
+    msg.dwBufferCount = 1;
+    msg.Control.buf = reinterpret_cast<char*>(control);
+    msg.Control.len = WSA_CMSG_SPACE(sizeof(IN_PKTINFO));
+
+    WSACMSGHDR *cmsg = WSA_CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = IPPROTO_IP;
+    cmsg->cmsg_type = IP_PKTINFO;
+    cmsg->cmsg_len = WSA_CMSG_LEN(sizeof(IN_PKTINFO));
+    IN_PKTINFO info;
+    info.ipi_addr.s_addr = cfg->server_ip;
+    info.ipi_ifindex = ifindex;
+    mem_cpy(WSA_CMSG_DATA(cmsg), &info, sizeof(info));
+
+    DWORD sent;
+    if (WSASendMsg(sock, &msg, 0, &sent, nullptr, nullptr) != 0)
+    {
+        print_fmt("sr error %d\n", WSAGetLastError());
+        return false;
+    }
+    req->tsc[MARK_SENT] = __rdtsc();
+    record_latency(&cfg->stats, req);
+    return commit_reply(req);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Never returns. The one thread serves all interfaces, so it takes the first
+// cpu and the first priority that any of them asks for. They are applied
+// once; a reload does not change them.
+
+void wild_run()
+{
+    const ConfigTable *tbl = config_table();
+    uint32_t cpu = CPU_ANY;
+    uint32_t priority = 0;
+    for (uint32_t idx = 0; idx < tbl->num_ifaces; idx++)
+    {
+        const Config &cfg = tbl->configs[idx];
+        print_config(cfg);
+        if (cpu == CPU_ANY)
+        {
+            cpu = cfg.cpu;
+        }
+        if (priority == 0)
+        {
+            priority = cfg.priority;
+        }
+    }
+    sched_set(cpu, priority);
+
+    IfaceMap map;
+    zero_init(map);
+    Request req;
+    zero_init(req);
+    sched_lock(&req, sizeof(req));
+    for (;;)
+    {
+        NET_IFINDEX ifindex = 0;
+        const int size = receive(&req, &ifindex);
+        if (size == SOCKET_ERROR)
+        {
+            continue;
+        }
+        // Datagrams from interfaces without a section are dropped without
+        // being counted, since there is no Config to count them in.
+        Config *cfg = lookup(&map, ifindex);
+        if (cfg == nullptr || !parse_request(&req, size, cfg))
+        {
+            continue;
+        }
+        sockaddr_in to;
+        const int reply_size = prepare_reply(&req, cfg, &to);
+        if (
+            reply_size > 0 &&
+            transmit(&req, cfg, ifindex, to, reply_size)
+            )
+        {
+            log_allotted(&req);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////